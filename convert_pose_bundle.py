@@ -0,0 +1,67 @@
+import argparse
+import glob
+import numpy as np
+import os
+
+from src.utils.pose_bundle import write_pose_bundle
+
+import decord
+
+decord.bridge.set_bridge("torch")
+
+
+def load_frames(path, fps=16):
+    # same resampling as `load_video` in inference.py, but keep all frames in uint8 T H W C
+    video_reader = decord.VideoReader(path)
+    video_length = len(video_reader)
+    ori_fps = video_reader.get_avg_fps()
+    normed_video_length = max(round(video_length / ori_fps * fps), 1)
+    batch_index = np.linspace(0, video_length - 1, normed_video_length).round().astype(int).tolist()
+    video = video_reader.get_batch(batch_index)
+    del video_reader
+    return video
+
+
+def convert(smpl_path, hamer_path, output_path, max_resolutions, fps=16):
+    smpl = load_frames(smpl_path, fps=fps)
+    hamer = load_frames(hamer_path, fps=fps)
+    if smpl.shape[0] != hamer.shape[0]:
+        print(f"WARNING: {smpl_path} and {hamer_path} have different length, truncate to the shorter one.")
+    num_frames = min(smpl.shape[0], hamer.shape[0])
+    write_pose_bundle(output_path, smpl[:num_frames], hamer[:num_frames], max_resolutions, fps=fps)
+
+
+def main():
+    # argparse
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--smpl', type=str, default=None, help='Path to smpl video.')
+    parser.add_argument('--hamer', type=str, default=None, help='Path to hamer video.')
+    parser.add_argument('--output', type=str, default=None, help='Path to output pose bundle.')
+    parser.add_argument(
+        '--root', type=str, default=None,
+        help='Root path for batch conversion. Bundles are saved to `root/pose_bundle`.',
+    )
+    parser.add_argument(
+        '--max-res', type=int, nargs='+', default=[480 * 832, 640 * 640, 768 * 768],
+        help='Resolution levels stored in the bundle.',
+    )
+    parser.add_argument('--fps', type=int, default=16, help='Frame rate of the stored streams.')
+    args = parser.parse_args()
+
+    # check args
+    if args.root is None and (args.smpl is None or args.hamer is None or args.output is None):
+        raise ValueError("`root` and `smpl` / `hamer` / `output` cannot be None at the same time.")
+
+    if args.root is not None:  # batch conversion
+        os.makedirs(os.path.join(args.root, "pose_bundle"), exist_ok=True)
+        for smpl_path in sorted(glob.glob(os.path.join(args.root, "smpl", "*.mp4"))):
+            vid = os.path.splitext(os.path.basename(smpl_path))[0]
+            hamer_path = os.path.join(args.root, "hamer", f"{vid}.mp4")
+            output_path = os.path.join(args.root, "pose_bundle", f"{vid}.rdpb")
+            convert(smpl_path, hamer_path, output_path, args.max_res, fps=args.fps)
+    else:
+        convert(args.smpl, args.hamer, args.output, args.max_res, fps=args.fps)
+
+
+if __name__ == "__main__":
+    main()
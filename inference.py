@@ -1,14 +1,29 @@
 import argparse
+import contextlib
 import glob
 import numpy as np
 import os
+import signal
+import threading
 import torch
 
 from diffusers import AutoencoderKLWan
 from diffusers.utils import export_to_video
 from PIL import Image
 from src.pipelines.rd_dit_pipeline import RealisDanceDiTPipeline
+from src.pipelines.stage_pipeline import StagePipeline
+from src.pipelines.step_batching import StepBatcher
+from src.serving.cost_model import AdmissionController, CostModel, calibrate
+from src.serving.server import InferenceService
+from src.utils.pose_bundle import PoseBundle, get_target_shape
+from src.utils.pose_stream import PoseStreamReader, encode_pose_stream, open_pose_stream
+from src.utils.preview import LatentPreviewDecoder, LatentPreviewer, fit_preview_decoder
 from src.utils.dist_utils import hook_for_multi_gpu_inference, init_dist, is_main_process, set_seed
+from src.utils.load_utils import StartupTimer, load_pipeline_parallel
+from src.utils.metrics import MetricsRegistry
+from src.utils.snapshot import export_snapshot, load_snapshot
+from src.utils.video_stream import StreamingVideoWriter
+from src.utils.worker_pool import CPUWorkerPool
 from transformers import CLIPVisionModel
 
 import decord
@@ -21,14 +36,10 @@ def is_image(path):
     return path.lower().endswith(valid_extensions)
 
 
-def load_image(path, div=127.5, add=-1):
-    # read image
+def load_image(path):
+    # read image, normalization and H W C -> B C F H W are done on the device by the pipeline
     image = torch.from_numpy(np.array(Image.open(path).convert("RGB")))
-    # [0, 255] -> [-1, 1]
-    image = image / div + add
-    # H W C -> B C F H W
-    image = image.permute(2, 0, 1).unsqueeze(0).unsqueeze(2)
-    return image
+    return image  # H W C, uint8
 
 
 def load_video(
@@ -36,19 +47,181 @@ def load_video(
     fps=16,
     start_index=0,
     num_frames=81,
-    div=127.5,
-    add=-1,
 ):
     video_reader = decord.VideoReader(path)
     video_length = len(video_reader)
     ori_fps = video_reader.get_avg_fps()
-    normed_video_length = max(round(video_length / ori_fps * fps), num_frames)
+    normed_video_length = round(video_length / ori_fps * fps)
+    if num_frames is None:  # the whole video
+        num_frames = normed_video_length - start_index
+    normed_video_length = max(normed_video_length, num_frames)
     batch_index_all = np.linspace(0, video_length - 1, normed_video_length).round().astype(int).tolist()
     batch_index = batch_index_all[start_index:start_index + num_frames]
-    video = video_reader.get_batch(batch_index).permute(3, 0, 1, 2).unsqueeze(0).contiguous()
+    video = video_reader.get_batch(batch_index)
     del video_reader
-    video = video / div + add
-    return video  # 1 C T H W
+    return video  # T H W C, uint8
+
+
+def load_pose_bundle(
+    path,
+    max_resolution,
+    start_index=0,
+    num_frames=81,
+):
+    bundle = PoseBundle(path)
+    level = bundle.get_level(max_resolution)
+    if num_frames is None:  # the whole sequence
+        num_frames = len(bundle) - start_index
+    # frames are stored at bundle.fps already, only stretch short sequences like `load_video`
+    normed_video_length = max(len(bundle), num_frames)
+    batch_index_all = np.linspace(0, len(bundle) - 1, normed_video_length).round().astype(int)
+    batch_index = batch_index_all[start_index:start_index + num_frames]
+    if np.all(np.diff(batch_index) == 1):  # contiguous range, a single read from the mmap
+        batch_index = slice(int(batch_index[0]), int(batch_index[-1]) + 1)
+    else:
+        batch_index = batch_index.tolist()
+    smpl = torch.from_numpy(np.array(bundle.get_frames(level, "smpl", batch_index)))
+    hamer = torch.from_numpy(np.array(bundle.get_frames(level, "hamer", batch_index)))
+    # the generation shape follows the source video, so that a missing level only costs a resize
+    height, width = bundle.get_target_shape(max_resolution)
+    return smpl, hamer, height, width  # T H W C, uint8
+
+
+def load_batch_sample(ref_path, root, save_dir, max_res, num_frames, enable_teacache):
+    # path process
+    vid = os.path.splitext(os.path.basename(ref_path))[0]
+    output_path = os.path.join(save_dir, f"{vid}.mp4")
+    smpl_path = os.path.join(root, "smpl", f"{vid}.mp4")
+    hamer_path = os.path.join(root, "hamer", f"{vid}.mp4")
+    pose_bundle_path = os.path.join(root, "pose_bundle", f"{vid}.rdpb")
+    prompt_path = os.path.join(root, "prompt", f"{vid}.txt")
+
+    # prompt process
+    prompt = ""
+    with open(prompt_path, 'r', encoding='utf-8') as file:
+        for l in file.readlines():
+            prompt += l.strip()
+
+    # prepare inputs, inference, and save
+    ref_image = load_image(ref_path)
+    if os.path.exists(pose_bundle_path):
+        smpl, hamer, height, width = load_pose_bundle(pose_bundle_path, max_res, num_frames=num_frames)
+    else:
+        smpl = load_video(smpl_path, num_frames=num_frames)
+        hamer = load_video(hamer_path, num_frames=num_frames)
+        height = width = None
+    pipe_kwargs = dict(
+        image=ref_image,
+        smpl=smpl,
+        hamer=hamer,
+        prompt=prompt,
+        height=height,
+        width=width,
+        max_resolution=max_res,
+        enable_teacache=enable_teacache,
+    )
+    return pipe_kwargs, output_path
+
+
+def time_stage(metrics, stage):
+    # no-op without a metrics registry
+    return metrics.time_stage(stage) if metrics is not None else contextlib.nullcontext()
+
+
+def infer_batch_sample(
+    pipe, ref_path, root, save_dir, max_res, num_frames, enable_teacache, concurrent_conditioning=False
+):
+    pipe_kwargs, output_path = load_batch_sample(ref_path, root, save_dir, max_res, num_frames, enable_teacache)
+    output = pipe(**pipe_kwargs, concurrent_conditioning=concurrent_conditioning).frames[0]
+    if is_main_process():
+        with time_stage(pipe.metrics, "export"):
+            export_to_video(output, output_path, fps=16)
+    return output_path
+
+
+def serve(
+    pipe, address, save_dir, max_res, num_frames, enable_teacache, max_batch_size=1,
+    cost_model_path=None, memory_limit=None, max_backlog=None,
+):
+    batcher = None
+    if max_batch_size > 1:
+        # denoising steps of concurrent jobs are batched in one transformer forward
+        batcher = StepBatcher(pipe, max_batch_size=max_batch_size)
+        threading.Thread(target=batcher.run_forever, daemon=True).start()
+
+    def get_bucket(params):
+        if params.get("ref") is None or params.get("prompt") is None:
+            raise ValueError("`ref` and `prompt` are required.")
+        job_max_res = params.get("max_res", max_res)
+        job_num_frames = params.get("num_frames", num_frames)
+        job_num_frames = (job_num_frames - 1) // pipe.vae_scale_factor_temporal * pipe.vae_scale_factor_temporal + 1
+        if params.get("pose_bundle") is not None:
+            height, width = PoseBundle(params["pose_bundle"]).get_target_shape(job_max_res)
+        elif params.get("smpl") is not None and params.get("hamer") is not None:
+            ori_h, ori_w = decord.VideoReader(params["smpl"])[0].shape[:2]
+            height, width = get_target_shape(ori_h, ori_w, job_max_res)
+        else:
+            raise ValueError("Either `pose_bundle` or `smpl` / `hamer` is required.")
+        return height, width, job_num_frames
+
+    def run_job(job):
+        params = job.params
+        height, width, job_num_frames = job.bucket
+        job_max_res = params.get("max_res", max_res)
+        if params.get("pose_bundle") is not None:
+            smpl, hamer, _, _ = load_pose_bundle(params["pose_bundle"], job_max_res, num_frames=job_num_frames)
+        else:
+            smpl = load_video(params["smpl"], num_frames=job_num_frames)
+            hamer = load_video(params["hamer"], num_frames=job_num_frames)
+        pipe_kwargs = dict(
+            image=load_image(params["ref"]),
+            smpl=smpl,
+            hamer=hamer,
+            prompt=params["prompt"],
+            enable_teacache=params.get("enable_teacache", enable_teacache),
+            generator=torch.Generator().manual_seed(params.get("seed", 1024)),
+        )
+        if batcher is not None:
+            output = batcher.submit(height=height, width=width, num_frames=job_num_frames, **pipe_kwargs).result()[0]
+        else:
+            # the bucket and the reference size are the plan key, such jobs reuse all shape-dependent state
+            ref_size = pipe.get_ref_size(pipe_kwargs["image"], height, width)
+            output = pipe.run(pipe.plan(height, width, job_num_frames, ref_size=ref_size), **pipe_kwargs).frames[0]
+        output_path = os.path.join(save_dir, f"{job.id}.mp4")
+        with time_stage(pipe.metrics, "export"):
+            export_to_video(output, output_path, fps=16)
+        return output_path
+
+    admission = None
+    if cost_model_path is not None:
+        if os.path.exists(cost_model_path):
+            cost_model = CostModel.load(cost_model_path)
+        else:
+            print("Calibrating the cost model, this takes a few minutes.")
+            cost_model = calibrate(pipe)
+            cost_model.save(cost_model_path)
+            print(f"Cost model saved to {cost_model_path}.")
+
+        def get_cost(params, bucket):
+            height, width, job_num_frames = bucket
+            return cost_model.predict(
+                height, width, job_num_frames,
+                # batched jobs run without teacache
+                enable_teacache=batcher is None and params.get("enable_teacache", enable_teacache),
+            )
+
+        admission = AdmissionController(
+            cost_model,
+            memory_limit=memory_limit * 2 ** 30 if memory_limit is not None else None,
+            max_backlog=max_backlog,
+        )
+    else:
+        get_cost = None
+
+    InferenceService(
+        run_job, get_bucket, num_workers=max_batch_size, get_cost=get_cost, admission=admission,
+        metrics=pipe.metrics,
+    ).serve_forever(address)
 
 
 def main():
@@ -57,13 +230,109 @@ def main():
     parser.add_argument('--ref', type=str, default=None, help='path to reference image.')
     parser.add_argument('--smpl', type=str, default=None, help='Path to smpl video.')
     parser.add_argument('--hamer', type=str, default=None, help='Path to hamer video.')
+    parser.add_argument(
+        '--pose-bundle', type=str, default=None, help='Path to pose bundle, used instead of `smpl` / `hamer`.',
+    )
+    parser.add_argument(
+        '--pose-stream', type=str, default=None,
+        help='Read smpl / hamer frames from a pipe path, `unix:<socket path>` or `-` for stdin, '
+             'used instead of `smpl` / `hamer`.',
+    )
+    parser.add_argument(
+        '--refs', type=str, nargs='+', default=None,
+        help='Several reference images animated with the same pose in one fan-out run, used instead of `ref`.',
+    )
+    parser.add_argument(
+        '--pose-bundles', type=str, nargs='+', default=None,
+        help='Several pose bundles animating the same `ref` in one fan-out run, used instead of `smpl` / `hamer`.',
+    )
+    parser.add_argument(
+        '--fan-out-batch-size', type=int, default=4, help='Denoise up to this many fan-out videos in one batch.',
+    )
     parser.add_argument('--prompt', type=str, default=None, help='Prompt for video.')
     parser.add_argument('--root', type=str, default=None, help='Root path for batch inference.')
     parser.add_argument('--save-dir', type=str, default="./output", help='Path to output folder.')
     parser.add_argument('--ckpt', type=str, default="./pretrained_models", help='Path to checkpoint folder.')
     parser.add_argument('--max-res', type=int, default=768 * 768, help='Resolution of the generated video.')
     parser.add_argument('--num-frames', type=int, default=81, help='Number of the generated video frames.')
+    parser.add_argument(
+        '--window-frames', type=int, default=None,
+        help='Generate `num-frames` frames of any length in overlapping windows of this many frames, e.g., 81.',
+    )
+    parser.add_argument(
+        '--window-overlap', type=int, default=16, help='Frames shared by neighboring windows, a multiple of 4.',
+    )
+    parser.add_argument(
+        '--tile-size', type=int, default=None,
+        help='Denoise in overlapping spatial tiles of this many pixels, e.g., 768 with `--max-res 2073600` for 1080p.',
+    )
+    parser.add_argument('--tile-overlap', type=int, default=128, help='Pixels shared by neighboring tiles.')
+    parser.add_argument(
+        '--low-res-steps', type=int, default=0,
+        help='Run this many first steps at a lower resolution, then finish at full resolution, e.g., 10.',
+    )
+    parser.add_argument(
+        '--low-res-factor', type=int, default=2, help='Height and width downsampling factor of `--low-res-steps`.',
+    )
+    parser.add_argument(
+        '--region-skip-interval', type=int, default=1,
+        help='Refresh the background (outside of the character) prediction every this many steps only and run the '
+             'character tokens alone in between, e.g., 3.',
+    )
+    parser.add_argument(
+        '--region-freeze-step', type=int, default=None,
+        help='Stop refreshing the background prediction from this step on, e.g., 20.',
+    )
+    parser.add_argument(
+        '--region-dilation', type=int, default=2,
+        help='Grow the character region of `--region-skip-interval` / `--region-freeze-step` by this many tokens.',
+    )
+    parser.add_argument(
+        '--local-attention', type=int, nargs=3, default=None, metavar=('F', 'H', 'W'),
+        help='Self-attention of video tokens within windows of F x H x W tokens (after patching), shifted on every '
+             'second block, plus global attention to the reference tokens. Cheaper for long or large videos.',
+    )
+    parser.add_argument(
+        '--local-attention-blocks', type=int, nargs=2, default=None, metavar=('START', 'END'),
+        help='Use `--local-attention` in the blocks START to END - 1 only, e.g., `0 30`.',
+    )
+    parser.add_argument(
+        '--pose-sparse-attention', type=int, nargs=3, default=None, metavar=('F', 'H', 'W'),
+        help='Global self-attention for the character (foreground tokens from the SMPL / HaMeR latents) and the '
+             'reference tokens, attention within windows of F x H x W tokens (after patching) for the background.',
+    )
+    parser.add_argument(
+        '--pose-sparse-attention-blocks', type=int, nargs=2, default=None, metavar=('START', 'END'),
+        help='Use `--pose-sparse-attention` in the blocks START to END - 1 only, e.g., `0 30`.',
+    )
+    parser.add_argument(
+        '--pose-mask-dilation', type=int, default=1,
+        help='Grow the foreground of `--pose-sparse-attention` by this many tokens in height and width.',
+    )
+    parser.add_argument(
+        '--token-merging', type=float, default=None, metavar='RATIO',
+        help='Merge this fraction (at most 0.75) of similar video tokens before every block and unmerge them after, '
+             'e.g., `0.5`. The reference tokens are never merged.',
+    )
+    parser.add_argument(
+        '--token-merging-blocks', type=int, nargs=2, default=None, metavar=('START', 'END'),
+        help='Use `--token-merging` in the blocks START to END - 1 only, e.g., `10 40`.',
+    )
+    parser.add_argument(
+        '--token-merging-min-timestep', type=float, default=0, metavar='T',
+        help='Use `--token-merging` only at timesteps >= T (0 to 1000), i.e., in the early, noisy steps.',
+    )
+    parser.add_argument(
+        '--stream-output', action='store_true',
+        help='Generate window by window, each window continues the previous one over `window-overlap` frames, '
+             'and write every chunk as soon as it is ready. Runs over the whole pose sequence, or with '
+             '`--pose-stream` until the stream ends; `num-frames` is not used.',
+    )
     parser.add_argument('--seed', type=int, default=1024, help='The generation seed.')
+    parser.add_argument(
+        '--num-variants', type=int, default=1,
+        help='Generate this many variants with seeds `seed`, `seed + 1`, ... in one batch, saved as `*_seed{seed}.mp4`.',
+    )
     parser.add_argument('--save-gpu-memory', action='store_true', help='Save GPU memory, but will be super slow.')
     parser.add_argument(
         '--multi-gpu', action='store_true', help='Enable FSDP and Sequential parallel for multi-GPU inference.',
@@ -72,107 +341,523 @@ def main():
         '--enable-teacache', action='store_true',
         help='Enable teacache to accelerate inference. Note that enabling teacache may hurt generation quality.',
     )
+    parser.add_argument(
+        '--fast-start', action='store_true',
+        help='Load model components concurrently and print a start-up time breakdown.',
+    )
+    parser.add_argument(
+        '--export-snapshot', type=str, default=None,
+        help='Export the prepared model weights to a snapshot file for instant reload, and exit.',
+    )
+    parser.add_argument('--snapshot', type=str, default=None, help='Load model weights from a snapshot file.')
+    parser.add_argument(
+        '--checkpoint', type=str, default=None,
+        help='Save the denoising state here every `--checkpoint-steps` steps and on SIGTERM, e.g., for spot instances.',
+    )
+    parser.add_argument('--checkpoint-steps', type=int, default=None, help='Checkpoint interval in steps.')
+    parser.add_argument('--resume', type=str, default=None, help='Resume a generation from a saved denoising state.')
+    parser.add_argument(
+        '--serve', type=str, default=None,
+        help='Keep the model resident and serve jobs on `host:port` or `unix:<socket path>`.',
+    )
+    parser.add_argument(
+        '--max-batch-size', type=int, default=1,
+        help='Batch denoising steps of up to this many concurrent jobs in server mode (disables teacache).',
+    )
+    parser.add_argument(
+        '--cost-model', type=str, default=None,
+        help='Latency cost model for ETA and admission control in server mode, calibrated and saved here if missing.',
+    )
+    parser.add_argument(
+        '--memory-limit', type=float, default=None, help='Reject server jobs predicted to need more GPU memory (GiB).',
+    )
+    parser.add_argument(
+        '--max-backlog', type=float, default=None, help='Reject server jobs when the predicted backlog exceeds this (s).',
+    )
+    parser.add_argument(
+        '--cpu-workers', type=int, default=None,
+        help='Run batch inference on CPU in this many forked workers sharing one copy of the weights.',
+    )
+    parser.add_argument(
+        '--stage-devices', type=str, nargs=3, default=None, metavar=('ENCODE', 'DENOISE', 'DECODE'),
+        help='Pipeline batch inference over three devices, e.g., `cpu cuda:0 cuda:1`.',
+    )
+    parser.add_argument(
+        '--concurrent-conditioning', action='store_true',
+        help='Keep all models on the GPU and run the text, image and pose encoders concurrently.',
+    )
+    parser.add_argument(
+        '--preview-steps', type=int, default=None,
+        help='Save a cheap low-resolution preview of the predicted video every this many steps.',
+    )
+    parser.add_argument(
+        '--preview-decoder', type=str, default=None,
+        help='Latent preview decoder weights, fitted on the reference image and saved here if missing.',
+    )
+    parser.add_argument(
+        '--metrics-address', type=str, default=None,
+        help='Serve Prometheus metrics on `host:port`/metrics. In server mode they are also on the server address.',
+    )
+    parser.add_argument('--metrics-file', type=str, default=None, help='Dump Prometheus metrics to this file.')
+    parser.add_argument('--metrics-interval', type=float, default=15.0, help='Metrics file dump interval (s).')
     args = parser.parse_args()
 
     # assign args
     ref_path = args.ref
     smpl_path = args.smpl
     hamer_path = args.hamer
+    pose_bundle_path = args.pose_bundle
+    pose_stream = args.pose_stream
+    fan_out_ref_paths = args.refs
+    fan_out_pose_paths = args.pose_bundles
+    fan_out_batch_size = args.fan_out_batch_size
     prompt = args.prompt
     root = args.root
     save_dir = args.save_dir
     ckpt = args.ckpt
     max_res = args.max_res
     num_frames = args.num_frames
+    window_frames = args.window_frames
+    window_overlap = args.window_overlap
+    stream_output = args.stream_output
+    local_attention = args.local_attention
+    local_attention_blocks = args.local_attention_blocks
+    pose_sparse_attention = args.pose_sparse_attention
+    pose_sparse_attention_blocks = args.pose_sparse_attention_blocks
+    pose_mask_dilation = args.pose_mask_dilation
+    token_merging = args.token_merging
+    token_merging_blocks = args.token_merging_blocks
+    token_merging_min_timestep = args.token_merging_min_timestep
+    tile_size = args.tile_size
+    tile_overlap = args.tile_overlap
+    low_res_steps = args.low_res_steps
+    low_res_factor = args.low_res_factor
+    region_skip_interval = args.region_skip_interval
+    region_freeze_step = args.region_freeze_step
+    region_dilation = args.region_dilation
     seed = args.seed
+    num_variants = args.num_variants
     save_gpu_memory = args.save_gpu_memory
     multi_gpu = args.multi_gpu
     enable_teacache = args.enable_teacache
+    fast_start = args.fast_start
+    export_snapshot_path = args.export_snapshot
+    snapshot_path = args.snapshot
+    serve_address = args.serve
+    checkpoint_path = args.checkpoint
+    checkpoint_steps = args.checkpoint_steps
+    resume_path = args.resume
+    max_batch_size = args.max_batch_size
+    cost_model_path = args.cost_model
+    memory_limit = args.memory_limit
+    max_backlog = args.max_backlog
+    cpu_workers = args.cpu_workers
+    stage_devices = args.stage_devices
+    concurrent_conditioning = args.concurrent_conditioning
+    preview_steps = args.preview_steps
+    preview_decoder_path = args.preview_decoder
+    metrics_address = args.metrics_address
+    metrics_file = args.metrics_file
+    metrics_interval = args.metrics_interval
     os.makedirs(save_dir, exist_ok=True)
 
     # check args
-    if root is None and (ref_path is None or smpl_path is None or hamer_path is None):
+    if export_snapshot_path is not None and snapshot_path is not None:
+        raise ValueError("`--export-snapshot` and `--snapshot` cannot be set at the same time.")
+    if serve_address is not None and multi_gpu:
+        raise ValueError("`--serve` and `--multi-gpu` cannot be set at the same time.")
+    if (checkpoint_path is not None or resume_path is not None) and (root is not None or serve_address is not None):
+        raise ValueError("`--checkpoint` and `--resume` only support single sample inference.")
+    if export_snapshot_path is None and serve_address is None and resume_path is None and root is None and (
+        (ref_path is None and fan_out_ref_paths is None) or (
+            pose_bundle_path is None and fan_out_pose_paths is None and pose_stream is None and
+            (smpl_path is None or hamer_path is None)
+        )
+    ):
         raise ValueError("`root` and `ref` / `smpl` / `hamer` cannot be None at the same time.")
     elif root is not None and (ref_path is not None or smpl_path is not None or hamer_path is not None):
         print("WARNING: Will not use `ref` / `smpl` / `hamer` when `root` is not None.")
+    if pose_stream is not None and (root is not None or multi_gpu):
+        raise ValueError("`--pose-stream` only supports single sample inference on a single GPU.")
+    fan_out = fan_out_ref_paths is not None or fan_out_pose_paths is not None
+    if fan_out_ref_paths is not None and fan_out_pose_paths is not None:
+        raise ValueError("`--refs` and `--pose-bundles` cannot be set at the same time.")
+    if fan_out and (root is not None or pose_stream is not None or checkpoint_path is not None or multi_gpu):
+        raise ValueError(
+            "`--refs` / `--pose-bundles` do not support `--root`, `--pose-stream`, `--checkpoint` or `--multi-gpu`."
+        )
+    if num_variants > 1 and (
+        root is not None or serve_address is not None or resume_path is not None or checkpoint_path is not None or fan_out
+    ):
+        raise ValueError("`--num-variants` only supports single sample inference without `--checkpoint`.")
+    if window_frames is not None and (
+        root is not None or serve_address is not None or fan_out or num_variants > 1 or
+        checkpoint_path is not None or resume_path is not None or preview_steps is not None
+    ):
+        raise ValueError(
+            "`--window-frames` only supports single sample inference without `--num-variants`, `--checkpoint`, "
+            "`--resume` or `--preview-steps`."
+        )
+    if stream_output and (
+        root is not None or serve_address is not None or fan_out or num_variants > 1 or
+        checkpoint_path is not None or resume_path is not None or preview_steps is not None
+    ):
+        raise ValueError(
+            "`--stream-output` only supports single sample inference without `--num-variants`, `--checkpoint`, "
+            "`--resume` or `--preview-steps`."
+        )
+    if tile_size is not None and (
+        root is not None or serve_address is not None or fan_out or window_frames is not None or stream_output or
+        checkpoint_path is not None or resume_path is not None
+    ):
+        # a resumed state does not record the tiling, it would finish untiled
+        raise ValueError(
+            "`--tile-size` only supports single sample inference without `--window-frames`, `--stream-output`, "
+            "`--checkpoint` or `--resume`."
+        )
+    if low_res_steps > 0 and (
+        root is not None or serve_address is not None or fan_out or window_frames is not None or stream_output or
+        tile_size is not None or checkpoint_path is not None or resume_path is not None
+    ):
+        raise ValueError(
+            "`--low-res-steps` only supports single sample inference without `--window-frames`, `--stream-output`, "
+            "`--tile-size`, `--checkpoint` or `--resume`."
+        )
+    if (region_skip_interval > 1 or region_freeze_step is not None) and (
+        root is not None or serve_address is not None or fan_out or window_frames is not None or stream_output or
+        tile_size is not None or low_res_steps > 0 or enable_teacache or multi_gpu or
+        local_attention is not None or pose_sparse_attention is not None or token_merging is not None or
+        checkpoint_path is not None or resume_path is not None
+    ):
+        # the cached background prediction is not part of the denoising state
+        raise ValueError(
+            "`--region-skip-interval` / `--region-freeze-step` only support single sample inference without "
+            "`--window-frames`, `--stream-output`, `--tile-size`, `--low-res-steps`, `--enable-teacache`, "
+            "`--multi-gpu`, `--local-attention`, `--pose-sparse-attention`, `--token-merging`, `--checkpoint` or "
+            "`--resume`."
+        )
+    if local_attention is not None and multi_gpu:
+        raise ValueError("`--local-attention` and `--multi-gpu` cannot be set at the same time.")
+    if pose_sparse_attention is not None and (multi_gpu or local_attention is not None):
+        raise ValueError("`--pose-sparse-attention` cannot be set with `--multi-gpu` or `--local-attention`.")
+    if token_merging is not None and multi_gpu:
+        raise ValueError("`--token-merging` and `--multi-gpu` cannot be set at the same time.")
     if save_gpu_memory and multi_gpu:
         raise ValueError("`--multi-gpu` and `--save-gpu-memory` cannot be set at the same time.")
+    if cpu_workers is not None and (root is None or multi_gpu or save_gpu_memory):
+        raise ValueError("`--cpu-workers` only supports batch inference without `--multi-gpu` / `--save-gpu-memory`.")
+    if stage_devices is not None and (root is None or multi_gpu or save_gpu_memory or cpu_workers is not None):
+        raise ValueError(
+            "`--stage-devices` only supports batch inference without `--multi-gpu` / `--save-gpu-memory` / "
+            "`--cpu-workers`."
+        )
 
     # init dist and set seed
-    if multi_gpu:
-        init_dist()
-    set_seed(seed)
+    timer = StartupTimer()
+    with timer.record("init dist"):
+        if multi_gpu:
+            init_dist()
+        set_seed(seed)
 
     # load model
     model_id = ckpt
-    image_encoder = CLIPVisionModel.from_pretrained(
-        model_id, subfolder="image_encoder", torch_dtype=torch.float32
-    )
-    vae = AutoencoderKLWan.from_pretrained(model_id, subfolder="vae", torch_dtype=torch.float32)
-    pipe = RealisDanceDiTPipeline.from_pretrained(
-        model_id, vae=vae, image_encoder=image_encoder, torch_dtype=torch.bfloat16
-    )
-    if save_gpu_memory:
-        print("WARNING: Enable sequential cpu offload which will be super slow.")
-        pipe.enable_sequential_cpu_offload()
-    elif multi_gpu:
-        pipe = hook_for_multi_gpu_inference(pipe)
+    if snapshot_path is not None:
+        with timer.record("load snapshot"):
+            pipe = load_snapshot(snapshot_path)
+    elif fast_start:
+        pipe = load_pipeline_parallel(RealisDanceDiTPipeline, model_id, torch_dtype=torch.bfloat16, timer=timer)
     else:
-        pipe.enable_model_cpu_offload()
+        with timer.record("load pipeline"):
+            image_encoder = CLIPVisionModel.from_pretrained(
+                model_id, subfolder="image_encoder", torch_dtype=torch.float32
+            )
+            vae = AutoencoderKLWan.from_pretrained(model_id, subfolder="vae", torch_dtype=torch.float32)
+            pipe = RealisDanceDiTPipeline.from_pretrained(
+                model_id, vae=vae, image_encoder=image_encoder, torch_dtype=torch.bfloat16
+            )
+    if export_snapshot_path is not None:
+        if is_main_process():
+            # FSDP upcasts to float32 before sharding, store float32 weights for the multi-GPU path
+            export_snapshot(
+                pipe, export_snapshot_path, tokenizer_path=model_id, dtype=torch.float32 if multi_gpu else None
+            )
+            print(f"Snapshot saved to {export_snapshot_path}.")
+        return
+
+    with timer.record("place model"):
+        if save_gpu_memory:
+            print("WARNING: Enable sequential cpu offload which will be super slow.")
+            pipe.enable_sequential_cpu_offload()
+        elif multi_gpu:
+            pipe = hook_for_multi_gpu_inference(pipe)
+        elif cpu_workers is not None:
+            pass  # weights stay on CPU and are shared by the workers
+        elif stage_devices is not None:
+            pass  # modules are moved to their stage devices by `StagePipeline`
+        elif concurrent_conditioning:
+            pipe.to("cuda")  # offload hooks would evict one encoder when the next runs
+        else:
+            pipe.enable_model_cpu_offload()
+    if (fast_start or snapshot_path is not None) and is_main_process():
+        print(timer.summary())
+    if local_attention is not None:
+        pipe.transformer.set_window_attention(local_attention, blocks=local_attention_blocks)
+    if pose_sparse_attention is not None:
+        pipe.transformer.set_pose_sparse_attention(
+            pose_sparse_attention, blocks=pose_sparse_attention_blocks, dilation=pose_mask_dilation
+        )
+    if token_merging is not None:
+        pipe.transformer.set_token_merging(
+            token_merging if token_merging_min_timestep <= 0 else
+            lambda block, t: token_merging if t >= token_merging_min_timestep else 0.0,
+            blocks=token_merging_blocks,
+        )
+
+    # metrics
+    stop_metrics_dump = None
+    if (serve_address is not None or metrics_address is not None or metrics_file is not None) and is_main_process():
+        pipe.enable_metrics(MetricsRegistry())
+        if metrics_address is not None:
+            pipe.metrics.serve(metrics_address)
+        if metrics_file is not None:
+            stop_metrics_dump = pipe.metrics.dump_periodically(metrics_file, interval=metrics_interval)
 
     # inference
-    if root is not None:  # batch inference
-        for ref_path in glob.glob(os.path.join(root, "ref", "*")):
-            if not is_image(ref_path):
-                continue
+    if serve_address is not None:  # server mode
+        serve(
+            pipe, serve_address, save_dir, max_res, num_frames, enable_teacache, max_batch_size=max_batch_size,
+            cost_model_path=cost_model_path, memory_limit=memory_limit, max_backlog=max_backlog,
+        )
+    elif root is not None:  # batch inference
+        ref_paths = [p for p in glob.glob(os.path.join(root, "ref", "*")) if is_image(p)]
+        if stage_devices is not None:
+            # encode, denoise and decode of consecutive samples overlap on their own devices
+            stages = StagePipeline(pipe, *stage_devices).start()
+            pending = []
+
+            def export_next():
+                future, output_path = pending.pop(0)
+                try:
+                    output = future.result()[0]
+                    with time_stage(pipe.metrics, "export"):
+                        export_to_video(output, output_path, fps=16)
+                    status = "done"
+                except Exception as e:
+                    print(f"WARNING: {output_path} failed: {e}")
+                    status = "failed"
+                if pipe.metrics is not None:
+                    pipe.metrics.inc_request(status)
 
-            # path process
+            for ref_path in ref_paths:
+                pipe_kwargs, output_path = load_batch_sample(
+                    ref_path, root, save_dir, max_res, num_frames, enable_teacache
+                )
+                pending.append((
+                    stages.submit(**pipe_kwargs, concurrent_conditioning=concurrent_conditioning), output_path
+                ))
+                # save finished samples in order, without holding back the submissions
+                while pending and pending[0][0].done():
+                    export_next()
+            while pending:
+                export_next()
+            stages.stop()
+        elif cpu_workers is not None:
+            def run_job(ref_path):
+                # same seed per sample whichever worker runs it
+                set_seed(seed)
+                return infer_batch_sample(pipe, ref_path, root, save_dir, max_res, num_frames, enable_teacache)
+
+            pool = CPUWorkerPool(pipe, run_job, cpu_workers, share_memory=snapshot_path is None)
+            for ref_path, _, error in pool.map(ref_paths):
+                if error is not None:
+                    print(f"WARNING: {ref_path} failed.\n{error}")
+                # the workers' own stage metrics stay in their processes
+                if pipe.metrics is not None:
+                    pipe.metrics.inc_request("failed" if error is not None else "done")
+        else:
+            for ref_path in ref_paths:
+                infer_batch_sample(
+                    pipe, ref_path, root, save_dir, max_res, num_frames, enable_teacache,
+                    concurrent_conditioning=concurrent_conditioning,
+                )
+                if pipe.metrics is not None:
+                    pipe.metrics.inc_request("done")
+    elif resume_path is not None:  # resume an interrupted single sample inference
+        output_path = os.path.join(save_dir, f"{os.path.splitext(os.path.basename(resume_path))[0]}.mp4")
+        if checkpoint_path is not None:
+            signal.signal(signal.SIGTERM, lambda *_: setattr(pipe, "_interrupt", True))
+        output = pipe(
+            resume_from=resume_path,
+            checkpoint_path=checkpoint_path,
+            checkpoint_steps=checkpoint_steps,
+        ).frames
+        if output is None:
+            print(f"Interrupted, denoising state saved to {checkpoint_path}.")
+        elif is_main_process():
+            export_to_video(output[0], output_path, fps=16)
+    elif fan_out:  # one pose for many references, or one reference for many poses
+        if fan_out_ref_paths is not None:
+            pose_id = os.path.splitext(os.path.basename(pose_bundle_path or smpl_path))[0]
+            output_paths = [
+                os.path.join(save_dir, f"{os.path.splitext(os.path.basename(p))[0]}_{pose_id}.mp4")
+                for p in fan_out_ref_paths
+            ]
+            image = [load_image(p) for p in fan_out_ref_paths]
+            if pose_bundle_path is not None:
+                smpl, hamer, _, _ = load_pose_bundle(pose_bundle_path, max_res, num_frames=num_frames)
+            else:
+                smpl = load_video(smpl_path, num_frames=num_frames)
+                hamer = load_video(hamer_path, num_frames=num_frames)
+        else:
             vid = os.path.splitext(os.path.basename(ref_path))[0]
-            output_path = os.path.join(save_dir, f"{vid}.mp4")
-            smpl_path = os.path.join(root, "smpl", f"{vid}.mp4")
-            hamer_path = os.path.join(root, "hamer", f"{vid}.mp4")
-            prompt_path = os.path.join(root, "prompt", f"{vid}.txt")
-
-            # prompt process
-            prompt = ""
-            with open(prompt_path, 'r', encoding='utf-8') as file:
-                for l in file.readlines():
-                    prompt += l.strip()
-
-            # prepare inputs, inference, and save
-            ref_image = load_image(ref_path)
+            output_paths = [
+                os.path.join(save_dir, f"{vid}_{os.path.splitext(os.path.basename(p))[0]}.mp4")
+                for p in fan_out_pose_paths
+            ]
+            image = load_image(ref_path)
+            smpl, hamer = [], []
+            for p in fan_out_pose_paths:
+                pose_smpl, pose_hamer, _, _ = load_pose_bundle(p, max_res, num_frames=num_frames)
+                smpl.append(pose_smpl)
+                hamer.append(pose_hamer)
+        outputs = pipe.fan_out(
+            image=image,
+            smpl=smpl,
+            hamer=hamer,
+            prompt=prompt,
+            max_resolution=max_res,
+            num_frames=num_frames,
+            max_batch_size=fan_out_batch_size,
+            enable_teacache=enable_teacache,
+        )
+        for output, output_path in zip(outputs, output_paths):
+            export_to_video(output, output_path, fps=16)
+    elif stream_output:
+        # autoregressive windows, the video file grows while the next window is denoised
+        vid = os.path.splitext(os.path.basename(ref_path))[0]
+        if pose_stream is not None:
+            pose_id = "stream"
+        else:
+            pose_id = os.path.splitext(os.path.basename(pose_bundle_path or smpl_path))[0]
+        output_path = os.path.join(save_dir, f"{vid}_{pose_id}.mp4")
+        ref_image = load_image(ref_path)
+        if pose_stream is not None:
+            poses, height, width = PoseStreamReader(open_pose_stream(pose_stream), fps=16), None, None
+        elif pose_bundle_path is not None:
+            # the whole pose sequence, `window_frames` sets the chunking
+            smpl, hamer, height, width = load_pose_bundle(pose_bundle_path, max_res, num_frames=None)
+            poses = zip(smpl, hamer)
+        else:
+            poses = zip(load_video(smpl_path, num_frames=None), load_video(hamer_path, num_frames=None))
+            height = width = None
+        chunks = pipe.generate_stream(
+            image=ref_image,
+            poses=poses,
+            prompt=prompt,
+            height=height,
+            width=width,
+            max_resolution=max_res,
+            window_frames=window_frames or 81,
+            context_frames=window_overlap,
+        )
+        with StreamingVideoWriter(output_path, fps=16) if is_main_process() else contextlib.nullcontext() as writer:
+            for frames in chunks:
+                if writer is not None:
+                    writer.write(frames)
+                    print(f"{writer.num_frames} frames written to {output_path}")
+    else:  # single sample inference
+        # path process
+        vid = os.path.splitext(os.path.basename(ref_path))[0]
+        if pose_stream is not None:
+            pose_id = "stream"
+        else:
+            pose_id = os.path.splitext(os.path.basename(pose_bundle_path or smpl_path))[0]
+        output_path = os.path.join(save_dir, f"{vid}_{pose_id}.mp4")
+
+        # prepare inputs, inference, and save
+        if checkpoint_path is not None:
+            # preemption notice, e.g., on spot instances: save the state at the next step boundary and exit
+            signal.signal(signal.SIGTERM, lambda *_: setattr(pipe, "_interrupt", True))
+        ref_image = load_image(ref_path)
+        pose_latents = None
+        if pose_stream is not None:
+            # pose chunks are VAE-encoded while the upstream renderer is still producing frames
+            smpl = hamer = None
+            pose_latents, height, width = encode_pose_stream(
+                pipe, open_pose_stream(pose_stream), max_res, num_frames=num_frames
+            )
+        elif pose_bundle_path is not None:
+            smpl, hamer, height, width = load_pose_bundle(pose_bundle_path, max_res, num_frames=num_frames)
+        else:
             smpl = load_video(smpl_path, num_frames=num_frames)
             hamer = load_video(hamer_path, num_frames=num_frames)
+            height = width = None
+        generator = None
+        if num_variants > 1:
+            # one generator per variant, its seed goes into the file name
+            seeds = [seed + i for i in range(num_variants)]
+            generator = [torch.Generator(device=pipe._execution_device).manual_seed(s) for s in seeds]
+        previewer = None
+        if preview_steps is not None and is_main_process():
+            if preview_decoder_path is not None and os.path.exists(preview_decoder_path):
+                preview_decoder = LatentPreviewDecoder.load(preview_decoder_path)
+            else:
+                preview_decoder = fit_preview_decoder(pipe, [ref_image])
+                if preview_decoder_path is not None:
+                    preview_decoder.save(preview_decoder_path)
+            previewer = LatentPreviewer(
+                preview_decoder, interval=preview_steps, save_dir=os.path.join(save_dir, f"{vid}_{pose_id}_preview")
+            )
+        if window_frames is not None:
+            # long video: all `num_frames` frames, denoised in overlapping windows
+            output = pipe.generate_long(
+                image=ref_image,
+                smpl=smpl,
+                hamer=hamer,
+                prompt=prompt,
+                height=height,
+                width=width,
+                max_resolution=max_res,
+                window_frames=window_frames,
+                window_overlap=window_overlap,
+                pose_latents=pose_latents,
+            ).frames
+        else:
             output = pipe(
                 image=ref_image,
                 smpl=smpl,
                 hamer=hamer,
                 prompt=prompt,
+                height=height,
+                width=width,
                 max_resolution=max_res,
                 enable_teacache=enable_teacache,
-            ).frames[0]
-            if is_main_process():
-                export_to_video(output, output_path, fps=16)
-    else:  # single sample inference
-        # path process
-        vid = os.path.splitext(os.path.basename(ref_path))[0]
-        pose_id = os.path.splitext(os.path.basename(smpl_path))[0]
-        output_path = os.path.join(save_dir, f"{vid}_{pose_id}.mp4")
+                pose_latents=pose_latents,
+                num_videos_per_prompt=num_variants,
+                generator=generator,
+                concurrent_conditioning=concurrent_conditioning,
+                checkpoint_path=checkpoint_path,
+                checkpoint_steps=checkpoint_steps,
+                callback_on_step_end=previewer,
+                callback_on_step_end_tensor_inputs=previewer.tensor_inputs if previewer is not None else None,
+                tile_size=tile_size,
+                tile_overlap=tile_overlap,
+                low_res_steps=low_res_steps,
+                low_res_factor=low_res_factor,
+                region_skip_interval=region_skip_interval,
+                region_freeze_step=region_freeze_step,
+                region_dilation=region_dilation,
+            ).frames
+        if output is None:
+            print(f"Interrupted, denoising state saved to {checkpoint_path}. Continue with `--resume`.")
+        elif is_main_process() and num_variants > 1:
+            for variant_seed, video in zip(seeds, output):
+                export_to_video(video, os.path.join(save_dir, f"{vid}_{pose_id}_seed{variant_seed}.mp4"), fps=16)
+        elif is_main_process():
+            export_to_video(output[0], output_path, fps=16)
 
-        # prepare inputs, inference, and save
-        ref_image = load_image(ref_path)
-        smpl = load_video(smpl_path, num_frames=num_frames)
-        hamer = load_video(hamer_path, num_frames=num_frames)
-        output = pipe(
-            image=ref_image,
-            smpl=smpl,
-            hamer=hamer,
-            prompt=prompt,
-            max_resolution=max_res,
-            enable_teacache=enable_teacache,
-        ).frames[0]
-        if is_main_process():
-            export_to_video(output, output_path, fps=16)
+    if stop_metrics_dump is not None:
+        stop_metrics_dump()
 
 
 if __name__ == "__main__":
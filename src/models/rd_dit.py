@@ -13,7 +13,7 @@
 # limitations under the License.
 import math
 from dataclasses import dataclass
-from typing import Any, Dict, Optional, Tuple, Union
+from typing import Any, Callable, Dict, Optional, Tuple, Union
 
 import numpy as np
 import torch
@@ -40,13 +40,6 @@ from diffusers.utils import (
     BaseOutput,
 )
 
-from xfuser.core.distributed import (
-    get_sequence_parallel_rank,
-    get_sequence_parallel_world_size,
-    get_sp_group,
-)
-from xfuser.core.long_ctx_attention import xFuserLongContextAttention
-
 logger = logging.get_logger(__name__)  # pylint: disable=invalid-name
 
 
@@ -58,6 +51,11 @@ class AttnProcessorSP:
     def __init__(self):
         if not hasattr(F, "scaled_dot_product_attention"):
             raise ImportError("AttnProcessorSP requires PyTorch 2.0. To use it, please upgrade PyTorch to 2.0.")
+        # xfuser is only needed for sequential parallelism, import it lazily to keep single GPU start-up fast
+        from xfuser.core.distributed import get_sequence_parallel_world_size
+        from xfuser.core.long_ctx_attention import xFuserLongContextAttention
+        self.get_sequence_parallel_world_size = get_sequence_parallel_world_size
+        self.long_context_attention = xFuserLongContextAttention
 
     def __call__(
         self,
@@ -93,7 +91,7 @@ class AttnProcessorSP:
             query = apply_rotary_emb(query, rotary_emb)
             key = apply_rotary_emb(key, rotary_emb)
 
-        if get_sequence_parallel_world_size() > 1:
+        if self.get_sequence_parallel_world_size() > 1:
             # convert [batch, num_head, length, channel] -> [batch, length, num_head, channel]
             query, key, value = query.transpose(1, 2), key.transpose(1, 2), value.transpose(1, 2)
 
@@ -104,7 +102,7 @@ class AttnProcessorSP:
             query, key, value = half(query), half(key), half(value)
 
             # do attention
-            hidden_states = xFuserLongContextAttention()(
+            hidden_states = self.long_context_attention()(
                 None, query=query, key=key, value=value
             )
             # convert back
@@ -122,6 +120,301 @@ class AttnProcessorSP:
         return hidden_states
 
 
+class WindowAttnProcessor:
+    r"""
+    Local self-attention: every video token attends to the video tokens of its 3D (frame, height, width) window
+    and to all ref tokens, while the ref tokens keep global attention over all tokens. The cost of the video
+    queries grows linearly with the number of tokens instead of quadratically.
+
+    With `shift`, the window grid is offset by half a window, as in Swin Transformer; alternate shifted and regular
+    blocks so that information flows across window borders. Windows at the borders are padded, padding keys are
+    masked. Set by `RealisDanceDiT.set_window_attention`, which also keeps `grid` (the post-patch number of frames,
+    height and width of the video tokens) up to date on every forward.
+    """
+
+    def __init__(self, window_size: Tuple[int, int, int], shift: bool = False):
+        if not hasattr(F, "scaled_dot_product_attention"):
+            raise ImportError("WindowAttnProcessor requires PyTorch 2.0. To use it, please upgrade PyTorch to 2.0.")
+        self.window_size = tuple(window_size)
+        self.shift = shift
+        self.grid = None
+
+    def _partition(self, x: torch.Tensor) -> Tuple[torch.Tensor, Tuple[Any, ...]]:
+        # B N L C video tokens -> (B * windows) N window_len C, padded to whole windows
+        batch_size, heads, _, channels = x.shape
+        windows = tuple(min(window, size) for window, size in zip(self.window_size, self.grid))
+        pads = []
+        for size, window in zip(self.grid, windows):
+            front = window // 2 if self.shift and size > window else 0
+            pads.append((front, -(size + front) % window))
+        x = x.unflatten(2, self.grid)
+        x = F.pad(x, (0, 0) + sum(reversed(pads), ()))  # F.pad takes the pads of the last dims first
+        (wf, wh, ww) = windows
+        nf, nh, nw = x.shape[2] // wf, x.shape[3] // wh, x.shape[4] // ww
+        x = x.reshape(batch_size, heads, nf, wf, nh, wh, nw, ww, channels)
+        x = x.permute(0, 2, 4, 6, 1, 3, 5, 7, 8).reshape(batch_size * nf * nh * nw, heads, wf * wh * ww, channels)
+        return x, (windows, (nf, nh, nw), pads)
+
+    def _merge(self, x: torch.Tensor, batch_size: int, layout: Tuple[Any, ...]) -> torch.Tensor:
+        # inverse of `_partition`
+        (wf, wh, ww), (nf, nh, nw), pads = layout
+        heads, channels = x.shape[1], x.shape[-1]
+        x = x.view(batch_size, nf, nh, nw, heads, wf, wh, ww, channels)
+        x = x.permute(0, 4, 1, 5, 2, 6, 3, 7, 8).reshape(batch_size, heads, nf * wf, nh * wh, nw * ww, channels)
+        (f0, _), (h0, _), (w0, _) = pads
+        x = x[:, :, f0:f0 + self.grid[0], h0:h0 + self.grid[1], w0:w0 + self.grid[2]]
+        return x.flatten(2, 4)
+
+    def _attention(self, query: torch.Tensor, key: torch.Tensor, value: torch.Tensor) -> torch.Tensor:
+        # the video tokens come first, the ref tokens last
+        batch_size, num_video_tokens = query.shape[0], math.prod(self.grid)
+        ref_key, ref_value = key[:, :, num_video_tokens:], value[:, :, num_video_tokens:]
+
+        # ref queries: global attention over all tokens
+        ref_out = F.scaled_dot_product_attention(query[:, :, num_video_tokens:], key, value, dropout_p=0.0)
+
+        # video queries: the keys of their window, followed by all ref keys
+        window_query, layout = self._partition(query[:, :, :num_video_tokens])
+        window_key, _ = self._partition(key[:, :, :num_video_tokens])
+        window_value, _ = self._partition(value[:, :, :num_video_tokens])
+        num_windows = window_query.shape[0] // batch_size
+        window_key = torch.cat([window_key, ref_key.repeat_interleave(num_windows, dim=0)], dim=2)
+        window_value = torch.cat([window_value, ref_value.repeat_interleave(num_windows, dim=0)], dim=2)
+        # mask the padding keys, ref keys are always valid
+        valid, _ = self._partition(query.new_ones(1, 1, num_video_tokens, 1))
+        valid = valid.squeeze(-1) > 0  # windows 1 window_len, for the windows of one sample
+        valid = torch.cat([valid, valid.new_ones(valid.shape[0], 1, ref_key.shape[2])], dim=2)
+        attn_mask = valid[:, :, None].repeat(batch_size, 1, 1, 1)  # (B * windows) 1 1 keys
+        video_out = F.scaled_dot_product_attention(
+            window_query, window_key, window_value, attn_mask=attn_mask, dropout_p=0.0
+        )
+        video_out = self._merge(video_out, batch_size, layout)
+        return torch.cat([video_out, ref_out], dim=2)
+
+    def __call__(
+        self,
+        attn: Attention,
+        hidden_states: torch.Tensor,
+        encoder_hidden_states: Optional[torch.Tensor] = None,
+        attention_mask: Optional[torch.Tensor] = None,
+        rotary_emb: Optional[torch.Tensor] = None,
+    ) -> torch.Tensor:
+        if self.grid is None:
+            raise ValueError("`WindowAttnProcessor.grid` is not set, use `RealisDanceDiT.set_window_attention`.")
+
+        query = attn.to_q(hidden_states)
+        key = attn.to_k(hidden_states)
+        value = attn.to_v(hidden_states)
+
+        if attn.norm_q is not None:
+            query = attn.norm_q(query)
+        if attn.norm_k is not None:
+            key = attn.norm_k(key)
+
+        query = query.unflatten(2, (attn.heads, -1)).transpose(1, 2)
+        key = key.unflatten(2, (attn.heads, -1)).transpose(1, 2)
+        value = value.unflatten(2, (attn.heads, -1)).transpose(1, 2)
+
+        if rotary_emb is not None:
+
+            def apply_rotary_emb(hidden_states: torch.Tensor, freqs: torch.Tensor):
+                x_rotated = torch.view_as_complex(hidden_states.to(torch.float64).unflatten(3, (-1, 2)))
+                x_out = torch.view_as_real(x_rotated * freqs).flatten(3, 4)
+                return x_out.type_as(hidden_states)
+
+            query = apply_rotary_emb(query, rotary_emb)
+            key = apply_rotary_emb(key, rotary_emb)
+
+        hidden_states = self._attention(query, key, value)
+        hidden_states = hidden_states.transpose(1, 2).flatten(2, 3)
+        hidden_states = hidden_states.type_as(query)
+
+        hidden_states = attn.to_out[0](hidden_states)
+        hidden_states = attn.to_out[1](hidden_states)
+        return hidden_states
+
+
+class PoseSparseAttnProcessor(WindowAttnProcessor):
+    r"""
+    Pose-guided block-sparse self-attention: foreground video tokens (where the character is, see
+    `pose_foreground_mask`) and the ref tokens keep global attention over all tokens, while background video
+    tokens only attend to their local 3D window and to the ref tokens, as in `WindowAttnProcessor`. In typical shots
+    most video tokens are background, so most of the attention cost drops from quadratic to linear.
+
+    Only the windows holding background tokens run the local attention, and the foreground queries of all samples
+    run the global attention in one batch, padded to the largest foreground. Foreground queries in windows shared
+    with background are computed locally too and then replaced, which only costs along the character border.
+
+    Set by `RealisDanceDiT.set_pose_sparse_attention`, which also keeps `grid` and `mask` (B x video tokens, True for
+    foreground) up to date on every forward.
+    """
+
+    def __init__(self, window_size: Tuple[int, int, int], shift: bool = False):
+        super().__init__(window_size, shift=shift)
+        self.mask = None
+
+    def _attention(self, query: torch.Tensor, key: torch.Tensor, value: torch.Tensor) -> torch.Tensor:
+        if self.mask is None:
+            raise ValueError(
+                "`PoseSparseAttnProcessor.mask` is not set, use `RealisDanceDiT.set_pose_sparse_attention`."
+            )
+        # the video tokens come first, the ref tokens last
+        batch_size, heads, seq_len, channels = query.shape
+        num_video_tokens = math.prod(self.grid)
+        ref_key, ref_value = key[:, :, num_video_tokens:], value[:, :, num_video_tokens:]
+
+        # ref queries: global attention over all tokens
+        ref_out = F.scaled_dot_product_attention(query[:, :, num_video_tokens:], key, value, dropout_p=0.0)
+
+        # background queries: the windows holding any background token, with their keys and all ref keys
+        window_query, layout = self._partition(query[:, :, :num_video_tokens])
+        window_key, _ = self._partition(key[:, :, :num_video_tokens])
+        window_value, _ = self._partition(value[:, :, :num_video_tokens])
+        num_windows = window_query.shape[0] // batch_size
+        background, _ = self._partition((~self.mask)[:, None, :, None].to(query.dtype))
+        active = (background.flatten(1) > 0).any(dim=1).nonzero().squeeze(1)  # among (B * windows)
+        window_out = torch.zeros_like(window_query)
+        if active.numel() > 0:
+            sample = active // num_windows
+            # mask the padding keys, ref keys are always valid
+            valid, _ = self._partition(query.new_ones(1, 1, num_video_tokens, 1))
+            valid = valid.squeeze(-1) > 0  # windows 1 window_len, for the windows of one sample
+            valid = torch.cat([valid, valid.new_ones(valid.shape[0], 1, ref_key.shape[2])], dim=2)
+            window_out[active] = F.scaled_dot_product_attention(
+                window_query[active],
+                torch.cat([window_key[active], ref_key[sample]], dim=2),
+                torch.cat([window_value[active], ref_value[sample]], dim=2),
+                attn_mask=valid[active % num_windows][:, :, None],
+                dropout_p=0.0,
+            )
+        video_out = self._merge(window_out, batch_size, layout)
+
+        # foreground queries: global attention, written over their local result. The foreground of every sample is
+        # padded to the largest one with a dummy token at the end, which is dropped again
+        hidden_states = torch.cat([video_out, ref_out, query.new_zeros(batch_size, heads, 1, channels)], dim=2)
+        counts = self.mask.sum(dim=1)
+        num_foreground = int(counts.max())
+        if num_foreground > 0:
+            order = torch.argsort((~self.mask).to(torch.uint8), dim=1, stable=True)[:, :num_foreground]
+            padding = torch.arange(num_foreground, device=order.device)[None] >= counts[:, None]
+            index = order.masked_fill(padding, seq_len)[:, None, :, None].expand(-1, heads, -1, channels)
+            foreground_query = torch.cat([query, query.new_zeros(batch_size, heads, 1, channels)], dim=2)
+            foreground_query = foreground_query.gather(2, index)
+            hidden_states.scatter_(
+                2, index, F.scaled_dot_product_attention(foreground_query, key, value, dropout_p=0.0)
+            )
+        return hidden_states[:, :, :seq_len]
+
+
+def pose_foreground_mask(
+    pose_latents: torch.Tensor,
+    patch_size: Tuple[int, int, int] = (1, 2, 2),
+    threshold: float = 0.25,
+    dilation: int = 1,
+) -> torch.Tensor:
+    r"""
+    Foreground mask of the character from the normalized SMPL + HaMeR pose latents (B C F H W), per video token:
+    B x (F * H * W) after patching, True for foreground.
+
+    The pose renders have a flat black background, so in every latent frame the background is the per-channel
+    median over the frame, and latent pixels whose mean absolute difference to it is above `threshold` are
+    foreground. A token is foreground when any latent pixel of its patch is, and the mask is dilated by `dilation`
+    tokens in height and width to cover the motion blur and the clothes around the body.
+    """
+    pose_latents = pose_latents.float()
+    background = pose_latents.flatten(3).median(dim=-1).values[..., None, None]
+    mask = ((pose_latents - background).abs().mean(dim=1, keepdim=True) > threshold).float()
+    mask = F.max_pool3d(mask, kernel_size=patch_size, stride=patch_size, ceil_mode=True)
+    if dilation > 0:
+        kernel_size = (1, 2 * dilation + 1, 2 * dilation + 1)
+        mask = F.max_pool3d(mask, kernel_size=kernel_size, stride=1, padding=(0, dilation, dilation))
+    return mask.flatten(1) > 0
+
+
+def bipartite_soft_matching(
+    metric: torch.Tensor, grid: Tuple[int, int, int], ratio: float, group_frames: int = 4
+) -> Tuple[Optional[torch.Tensor], Optional[torch.Tensor]]:
+    r"""
+    Token merging by bipartite soft matching (ToMe), for B N C video tokens in (frame, height, width) order.
+
+    The video is split into groups of `group_frames` frames. In every group, the top-left token of every 2x2 spatial
+    cell is a destination, and the `ratio` fraction of the group's tokens whose features are the most similar to a
+    destination of the same group are merged into it. Returns the kept token indices `kept` (B K) and, for every
+    token, the index of the merged token it belongs to, `slots` (B N), or `(None, None)` when nothing is merged.
+    """
+    batch_size, num_tokens, _ = metric.shape
+    device = metric.device
+    metric = metric / metric.norm(dim=-1, keepdim=True)
+    index = torch.arange(num_tokens, device=device).view(grid)
+    is_dst = torch.zeros(grid, dtype=torch.bool, device=device)
+    is_dst[:, ::2, ::2] = True
+
+    kept, merged_src, merged_dst = [], [], []
+    for f in range(0, grid[0], group_frames):
+        group_index = index[f:f + group_frames].flatten()
+        group_is_dst = is_dst[f:f + group_frames].flatten()
+        src_index, dst_index = group_index[~group_is_dst], group_index[group_is_dst]
+        r = min(int(ratio * group_index.numel()), src_index.numel())
+        if r > 0:
+            scores = metric[:, src_index] @ metric[:, dst_index].transpose(1, 2)
+            node_max, node_idx = scores.max(dim=-1)
+            order = node_max.argsort(dim=-1, descending=True)
+            merged_src.append(src_index[order[:, :r]])
+            merged_dst.append(dst_index[node_idx.gather(1, order[:, :r])])
+            kept.append(src_index[order[:, r:]])
+        else:
+            kept.append(src_index.expand(batch_size, -1))
+        kept.append(dst_index.expand(batch_size, -1))
+    if not merged_src:
+        return None, None
+
+    kept = torch.cat(kept, dim=1)
+    slots = torch.empty(batch_size, num_tokens, dtype=torch.long, device=device)
+    slots.scatter_(1, kept, torch.arange(kept.shape[1], device=device).expand(batch_size, -1))
+    merged_src, merged_dst = torch.cat(merged_src, dim=1), torch.cat(merged_dst, dim=1)
+    slots.scatter_(1, merged_src, slots.gather(1, merged_dst))
+    return kept, slots
+
+
+def merged_block_forward(
+    block: nn.Module,
+    hidden_states: torch.Tensor,
+    encoder_hidden_states: torch.Tensor,
+    temb: torch.Tensor,
+    rotary_emb: torch.Tensor,
+    num_video_tokens: int,
+    grid: Tuple[int, int, int],
+    ratio: float,
+    group_frames: int = 4,
+) -> torch.Tensor:
+    r"""
+    Run `block` on fewer tokens: the video tokens are merged by `bipartite_soft_matching` (merged tokens are the
+    mean of their members and take the RoPE of their destination), the ref tokens are kept as is. The residual of
+    the block is unmerged, i.e., every merged video token receives the update of the token it was merged into.
+    """
+    video = hidden_states[:, :num_video_tokens]
+    kept, slots = bipartite_soft_matching(video, grid, ratio, group_frames)
+    if kept is None:
+        return block(hidden_states, encoder_hidden_states, temb, rotary_emb)
+
+    batch_size, num_kept, channels = kept.shape[0], kept.shape[1], hidden_states.shape[-1]
+    merged = video.new_zeros(batch_size, num_kept, channels, dtype=torch.float32).scatter_reduce(
+        1, slots[..., None].expand(-1, -1, channels), video.float(), reduce="mean", include_self=False
+    ).type_as(video)
+    x = torch.cat([merged, hidden_states[:, num_video_tokens:]], dim=1)
+    rotary_emb = torch.cat(
+        [
+            rotary_emb[0, 0, :num_video_tokens][kept].unsqueeze(1),
+            rotary_emb[:, :, num_video_tokens:].expand(batch_size, -1, -1, -1),
+        ],
+        dim=2,
+    )
+
+    residual = block(x, encoder_hidden_states, temb, rotary_emb) - x
+    video_residual = residual[:, :num_kept].gather(1, slots[..., None].expand(-1, -1, channels))
+    return hidden_states + torch.cat([video_residual, residual[:, num_kept:]], dim=1)
+
+
 class ShiftedWanRotaryPosEmbed(WanRotaryPosEmbed):
     def forward(
         self,
@@ -131,10 +424,21 @@ class ShiftedWanRotaryPosEmbed(WanRotaryPosEmbed):
         shift_h: bool,
         shift_w: bool,
         shift_f_size: int = 81,
+        offset: Tuple[int, int] = (0, 0),
+        canvas_size: Optional[Tuple[int, int]] = None,
+        stride: int = 1,
     ) -> torch.Tensor:
+        # `hidden_states` may be a spatial tile at latent `offset` of a larger latent `canvas_size` (height, width):
+        # its tokens then keep their canvas positions, and the ref tokens are shifted past the whole canvas.
+        # With `stride` > 1, the video and ref tokens are downsampled by `stride` and take every `stride`-th position
         batch_size, _, num_frames, height, width = hidden_states.shape
         p_t, p_h, p_w = self.patch_size
         ppf, pph, ppw = num_frames // p_t, height // p_h, width // p_w
+        off_h, off_w = offset[0] // p_h, offset[1] // p_w
+        if canvas_size is None:
+            canvas_pph, canvas_ppw = pph * stride, ppw * stride
+        else:
+            canvas_pph, canvas_ppw = canvas_size[0] // p_h, canvas_size[1] // p_w
 
         self.freqs = self.freqs.to(hidden_states.device)
         ori_freqs = self.freqs.split_with_sizes(
@@ -147,8 +451,8 @@ class ShiftedWanRotaryPosEmbed(WanRotaryPosEmbed):
         )
 
         freqs_f = ori_freqs[0][:ppf].view(ppf, 1, 1, -1).expand(ppf, pph, ppw, -1)
-        freqs_h = ori_freqs[1][:pph].view(1, pph, 1, -1).expand(ppf, pph, ppw, -1)
-        freqs_w = ori_freqs[2][:ppw].view(1, 1, ppw, -1).expand(ppf, pph, ppw, -1)
+        freqs_h = ori_freqs[1][off_h:off_h + pph * stride:stride].view(1, pph, 1, -1).expand(ppf, pph, ppw, -1)
+        freqs_w = ori_freqs[2][off_w:off_w + ppw * stride:stride].view(1, 1, ppw, -1).expand(ppf, pph, ppw, -1)
         freqs = torch.cat([freqs_f, freqs_h, freqs_w], dim=-1).reshape(1, 1, ppf * pph * ppw, -1)
 
         cond_batch_size, _, cond_num_frames, cond_height, cond_width = cond_states.shape
@@ -163,16 +467,16 @@ class ShiftedWanRotaryPosEmbed(WanRotaryPosEmbed):
             cond_freqs_f = ori_freqs[0][:cond_ppf].view(
                 cond_ppf, 1, 1, -1).expand(cond_ppf, cond_pph, cond_ppw, -1)
         if shift_h:
-            cond_freqs_h = ori_freqs[1][pph:pph + cond_pph].view(
+            cond_freqs_h = ori_freqs[1][canvas_pph:canvas_pph + cond_pph * stride:stride].view(
                 1, cond_pph, 1, -1).expand(cond_ppf, cond_pph, cond_ppw, -1)
         else:
-            cond_freqs_h = ori_freqs[1][:cond_pph].view(
+            cond_freqs_h = ori_freqs[1][:cond_pph * stride:stride].view(
                 1, cond_pph, 1, -1).expand(cond_ppf, cond_pph, cond_ppw, -1)
         if shift_w:
-            cond_freqs_w = ori_freqs[2][ppw:ppw + cond_ppw].view(
+            cond_freqs_w = ori_freqs[2][canvas_ppw:canvas_ppw + cond_ppw * stride:stride].view(
                 1, 1, cond_ppw, -1).expand(cond_ppf, cond_pph, cond_ppw, -1)
         else:
-            cond_freqs_w = ori_freqs[2][:cond_ppw].view(
+            cond_freqs_w = ori_freqs[2][:cond_ppw * stride:stride].view(
                 1, 1, cond_ppw, -1).expand(cond_ppf, cond_pph, cond_ppw, -1)
         cond_freqs = torch.cat(
             [cond_freqs_f, cond_freqs_h, cond_freqs_w], dim=-1).reshape(1, 1, cond_ppf * cond_pph * cond_ppw, -1)
@@ -211,8 +515,6 @@ class RealisDanceDiT(ModelMixin, ConfigMixin, PeftAdapterMixin, FromOriginalMode
                 Intermediate dimension in feed-forward network.
             num_layers (`int`, defaults to `40`):
                 The number of layers of transformer blocks to use.
-            window_size (`Tuple[int]`, defaults to `(-1, -1)`):
-                Window size for local attention (-1 indicates global attention).
             cross_attn_norm (`bool`, defaults to `True`):
                 Enable cross-attention normalization.
             qk_norm (`bool`, defaults to `True`):
@@ -313,6 +615,8 @@ class RealisDanceDiT(ModelMixin, ConfigMixin, PeftAdapterMixin, FromOriginalMode
 
         self.gradient_checkpointing = False
         self.sp_degree = 1
+        self.token_merging = None
+        self.pose_mask_kwargs = None
 
     def set_sp_degree(self, sp_degree: int):
         self.sp_degree = int(sp_degree)
@@ -323,6 +627,122 @@ class RealisDanceDiT(ModelMixin, ConfigMixin, PeftAdapterMixin, FromOriginalMode
             for block in self.blocks:
                 block.attn1.set_processor(WanAttnProcessor2_0())
 
+    def set_window_attention(
+        self,
+        window_size: Optional[Tuple[int, int, int]] = None,
+        blocks: Optional[Tuple[int, int]] = None,
+        shift: bool = True,
+    ):
+        r"""
+        Use local self-attention in the blocks `blocks[0]` to `blocks[1] - 1` (all blocks by default): video tokens
+        attend to a (frames, height, width) window of `window_size` video tokens (after patching) and to all ref
+        tokens, see `WindowAttnProcessor`. With `shift`, every second block of the range uses shifted windows.
+        `window_size=None` restores global attention. Not supported with sequence parallelism.
+        """
+        if window_size is not None and self.sp_degree > 1:
+            raise ValueError("Window attention is not supported with sequence parallelism.")
+        start, end = blocks if blocks is not None else (0, len(self.blocks))
+        for i in range(start, end):
+            if window_size is None:
+                processor = AttnProcessorSP() if self.sp_degree > 1 else WanAttnProcessor2_0()
+            else:
+                processor = WindowAttnProcessor(window_size, shift=shift and (i - start) % 2 == 1)
+            self.blocks[i].attn1.set_processor(processor)
+
+    def set_pose_sparse_attention(
+        self,
+        window_size: Optional[Tuple[int, int, int]] = None,
+        blocks: Optional[Tuple[int, int]] = None,
+        shift: bool = True,
+        threshold: float = 0.25,
+        dilation: int = 1,
+    ):
+        r"""
+        Use pose-guided sparse self-attention in the blocks `blocks[0]` to `blocks[1] - 1` (all blocks by default):
+        foreground video tokens and ref tokens attend to all tokens, background video tokens to a (frames, height,
+        width) window of `window_size` video tokens and to the ref tokens, see `PoseSparseAttnProcessor`. The
+        foreground is estimated from the pose latents on every forward, see `pose_foreground_mask` for `threshold`
+        and `dilation`. `window_size=None` restores global attention. Not supported with sequence parallelism.
+        """
+        if window_size is not None and self.sp_degree > 1:
+            raise ValueError("Pose sparse attention is not supported with sequence parallelism.")
+        start, end = blocks if blocks is not None else (0, len(self.blocks))
+        for i in range(start, end):
+            if window_size is None:
+                processor = AttnProcessorSP() if self.sp_degree > 1 else WanAttnProcessor2_0()
+            else:
+                processor = PoseSparseAttnProcessor(window_size, shift=shift and (i - start) % 2 == 1)
+            self.blocks[i].attn1.set_processor(processor)
+        self.pose_mask_kwargs = None if window_size is None else {"threshold": threshold, "dilation": dilation}
+
+    def set_token_merging(
+        self,
+        ratio: Union[float, Callable[[int, float], float], None] = None,
+        blocks: Optional[Tuple[int, int]] = None,
+        group_frames: int = 4,
+    ):
+        r"""
+        Merge redundant video tokens in the blocks `blocks[0]` to `blocks[1] - 1` (all blocks by default), see
+        `merged_block_forward`. `ratio` is the fraction of the video tokens merged away, at most 0.75, either a float
+        or a function `ratio(block_index, timestep)` of the block and the timestep (0 to 1000) of the forward, e.g.,
+        to merge more in the early, noisy steps; the samples of a forward then need the same timestep. The ref
+        tokens are never merged. Blocks with window attention are skipped. `ratio=None` disables token merging. Not
+        supported with sequence parallelism.
+        """
+        if ratio is None:
+            self.token_merging = None
+            return
+        if self.sp_degree > 1:
+            raise ValueError("Token merging is not supported with sequence parallelism.")
+        if not callable(ratio) and not 0 <= ratio <= 0.75:
+            raise ValueError(f"The token merging ratio must be in [0, 0.75], but got {ratio}.")
+        start, end = blocks if blocks is not None else (0, len(self.blocks))
+        self.token_merging = {"ratio": ratio, "blocks": range(start, end), "group_frames": group_frames}
+
+    def _token_merging_ratio(self, index: int, timestep_value: Optional[float]) -> float:
+        if self.token_merging is None or index not in self.token_merging["blocks"]:
+            return 0.0
+        if isinstance(self.blocks[index].attn1.processor, WindowAttnProcessor):
+            return 0.0
+        ratio = self.token_merging["ratio"]
+        return min(ratio(index, timestep_value), 0.75) if callable(ratio) else ratio
+
+    def prepare_rotary_emb(
+        self,
+        hidden_states: torch.Tensor,
+        attn_cond: torch.Tensor,
+        offset: Tuple[int, int] = (0, 0),
+        canvas_size: Optional[Tuple[int, int]] = None,
+        stride: int = 1,
+    ) -> torch.Tensor:
+        r"""
+        RoPE of the video + ref tokens, padded and split for sequence parallelism like the tokens in `forward`. Only
+        the shapes and the device of the inputs are used, so the result can be computed once per generation shape
+        and passed to `forward` as `rotary_emb`. For a spatial tile of the latents, pass its latent `offset` and the
+        latent (height, width) `canvas_size` of the whole video. For latents and ref latents downsampled by an
+        integer factor, pass it as `stride` to keep the positions of the full resolution.
+        """
+        rotary_emb = self.rope(
+            hidden_states,
+            attn_cond,
+            self.shift_f,
+            self.shift_h,
+            self.shift_w,
+            offset=offset,
+            canvas_size=canvas_size,
+            stride=stride,
+        )
+        if self.sp_degree > 1:
+            from xfuser.core.distributed import get_sequence_parallel_rank
+            seq_len = rotary_emb.shape[2]
+            if seq_len % self.sp_degree != 0:
+                padding_num = self.sp_degree - seq_len % self.sp_degree
+                rotary_emb = torch.cat(
+                    [rotary_emb, rotary_emb.new_zeros(
+                        rotary_emb.shape[0], rotary_emb.shape[1], padding_num, rotary_emb.shape[-1])], dim=2)
+            rotary_emb = torch.chunk(rotary_emb, self.sp_degree, dim=2)[get_sequence_parallel_rank()]
+        return rotary_emb
+
     def forward(
         self,
         hidden_states: torch.Tensor,
@@ -336,6 +756,8 @@ class RealisDanceDiT(ModelMixin, ConfigMixin, PeftAdapterMixin, FromOriginalMode
         enable_teacache: bool = False,
         current_step: int = 0,
         teacache_kwargs: Optional[Dict[str, Any]] = None,
+        rotary_emb: Optional[torch.Tensor] = None,
+        active_tokens: Optional[torch.Tensor] = None,
     ) -> Union[torch.Tensor, Dict[str, torch.Tensor]]:
         if attention_kwargs is not None:
             attention_kwargs = attention_kwargs.copy()
@@ -358,7 +780,16 @@ class RealisDanceDiT(ModelMixin, ConfigMixin, PeftAdapterMixin, FromOriginalMode
         post_patch_height = height // p_h
         post_patch_width = width // p_w
 
-        rotary_emb = self.rope(hidden_states, attn_cond, self.shift_f, self.shift_h, self.shift_w)
+        if rotary_emb is None:
+            rotary_emb = self.prepare_rotary_emb(hidden_states, attn_cond)
+        pose_mask = None
+        for block in self.blocks:
+            if isinstance(block.attn1.processor, WindowAttnProcessor):
+                block.attn1.processor.grid = (post_patch_num_frames, post_patch_height, post_patch_width)
+            if isinstance(block.attn1.processor, PoseSparseAttnProcessor):
+                if pose_mask is None:
+                    pose_mask = pose_foreground_mask(add_cond, self.config.patch_size, **(self.pose_mask_kwargs or {}))
+                block.attn1.processor.mask = pose_mask
 
         hidden_states = self.patch_embedding(hidden_states)
         add_cond = self.add_conv_in(add_cond)
@@ -368,6 +799,19 @@ class RealisDanceDiT(ModelMixin, ConfigMixin, PeftAdapterMixin, FromOriginalMode
         attn_cond = attn_cond.flatten(2).transpose(1, 2)
 
         hidden_states = hidden_states + self.add_proj(add_cond)
+        num_video_tokens = hidden_states.shape[1]
+        if active_tokens is not None:
+            # only run the video tokens at the indices `active_tokens`, the output is zero at the other tokens
+            if self.sp_degree > 1 or self.token_merging is not None or any(
+                isinstance(block.attn1.processor, WindowAttnProcessor) for block in self.blocks
+            ):
+                raise ValueError(
+                    "`active_tokens` is not supported with sequence parallelism, window attention or token merging."
+                )
+            hidden_states = hidden_states[:, active_tokens]
+            rotary_emb = torch.cat(
+                [rotary_emb[:, :, :num_video_tokens][:, :, active_tokens], rotary_emb[:, :, num_video_tokens:]], dim=2
+            )
         hidden_states_len = hidden_states.shape[1]
         hidden_states = torch.cat([hidden_states, attn_cond], dim=1)
 
@@ -382,6 +826,7 @@ class RealisDanceDiT(ModelMixin, ConfigMixin, PeftAdapterMixin, FromOriginalMode
         # 4. Transformer blocks
         # for sp split
         if self.sp_degree > 1:
+            from xfuser.core.distributed import get_sequence_parallel_rank
             original_seq_len = hidden_states.shape[1]
             if original_seq_len % self.sp_degree != 0:
                 # TODO: We should use attention mask to prevent processing padding tokens.
@@ -390,11 +835,14 @@ class RealisDanceDiT(ModelMixin, ConfigMixin, PeftAdapterMixin, FromOriginalMode
                 hidden_states = torch.cat(
                     [hidden_states, hidden_states.new_zeros(
                         hidden_states.shape[0], padding_num, hidden_states.shape[2])], dim=1)
-                rotary_emb = torch.cat(
-                    [rotary_emb, rotary_emb.new_zeros(
-                        rotary_emb.shape[0], rotary_emb.shape[1], padding_num, rotary_emb.shape[-1])], dim=2)
             hidden_states = torch.chunk(hidden_states, self.sp_degree, dim=1)[get_sequence_parallel_rank()]
-            rotary_emb = torch.chunk(rotary_emb, self.sp_degree, dim=2)[get_sequence_parallel_rank()]
+
+        timestep_value = None
+        if self.token_merging is not None and callable(self.token_merging["ratio"]):
+            # merged tokens are batched, so all samples share one ratio, e.g., not with step-level batching
+            timestep_min, timestep_value = (x.item() for x in timestep.flatten().aminmax())
+            if timestep_min != timestep_value:
+                raise ValueError("A timestep-dependent token merging ratio needs the same timestep for all samples.")
 
         def _block_forward(x):
             if torch.is_grad_enabled() and self.gradient_checkpointing:
@@ -403,8 +851,16 @@ class RealisDanceDiT(ModelMixin, ConfigMixin, PeftAdapterMixin, FromOriginalMode
                         block, x, encoder_hidden_states, timestep_proj, rotary_emb
                     )
             else:
-                for block in self.blocks:
-                    x = block(x, encoder_hidden_states, timestep_proj, rotary_emb)
+                for i, block in enumerate(self.blocks):
+                    ratio = self._token_merging_ratio(i, timestep_value)
+                    if ratio > 0:
+                        x = merged_block_forward(
+                            block, x, encoder_hidden_states, timestep_proj, rotary_emb, hidden_states_len,
+                            (post_patch_num_frames, post_patch_height, post_patch_width), ratio,
+                            self.token_merging["group_frames"],
+                        )
+                    else:
+                        x = block(x, encoder_hidden_states, timestep_proj, rotary_emb)
             return x
 
         if enable_teacache:
@@ -430,6 +886,7 @@ class RealisDanceDiT(ModelMixin, ConfigMixin, PeftAdapterMixin, FromOriginalMode
                     should_calc = True
                     teacache_kwargs["accumulated_rel_l1_distance"] = 0
             teacache_kwargs["previous_e0"] = modulated_inp.clone()
+            teacache_kwargs["should_calc"] = should_calc  # the decision of this forward, e.g., for metrics
             if should_calc:
                 ori_hidden_states = hidden_states.clone()
                 hidden_states = _block_forward(hidden_states)
@@ -441,6 +898,7 @@ class RealisDanceDiT(ModelMixin, ConfigMixin, PeftAdapterMixin, FromOriginalMode
 
         # for sp gather
         if self.sp_degree > 1:
+            from xfuser.core.distributed import get_sp_group
             hidden_states = get_sp_group().all_gather(hidden_states, dim=1)
 
         # 5. Output norm, projection & unpatchify
@@ -457,6 +915,10 @@ class RealisDanceDiT(ModelMixin, ConfigMixin, PeftAdapterMixin, FromOriginalMode
         hidden_states = self.proj_out(hidden_states)
 
         hidden_states = hidden_states[:, :hidden_states_len]
+        if active_tokens is not None:
+            hidden_states = hidden_states.new_zeros(batch_size, num_video_tokens, hidden_states.shape[-1]).index_copy_(
+                1, active_tokens, hidden_states
+            )
 
         hidden_states = hidden_states.reshape(
             batch_size, post_patch_num_frames, post_patch_height, post_patch_width, p_t, p_h, p_w, -1
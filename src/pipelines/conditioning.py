@@ -0,0 +1,120 @@
+# Copyright 2025 The RealisDance-DiT Team. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+from concurrent.futures import FIRST_COMPLETED, ThreadPoolExecutor, wait
+
+import torch
+
+
+def supports_concurrent_conditioning(pipe):
+    """
+    Whether the encoders of the pipeline may run at the same time. Not with accelerate offload hooks (model or
+    sequential CPU offload), which evict one model when the next runs, and not with FSDP-sharded encoders, whose
+    collectives issued from several threads could be ordered differently on each rank.
+    """
+    from torch.distributed.fsdp import FullyShardedDataParallel
+
+    return not any(
+        hasattr(component, "_hf_hook") or isinstance(component, FullyShardedDataParallel)
+        for component in pipe.components.values()
+        if isinstance(component, torch.nn.Module)
+    )
+
+
+def estimate_vae_encode_memory(num_videos, height, width):
+    """
+    Rough peak activation memory (bytes) of encoding `num_videos` videos in one Wan VAE encode. The causal encoder
+    processes 4 frames at a time, so it does not depend on the number of frames: about 4 live float32 feature maps
+    of 96 channels at full resolution per frame.
+    """
+    return num_videos * 4 * 96 * height * width * 4 * 4
+
+
+def _record_stream(obj, stream):
+    # tensors produced on a side stream and consumed on `stream` must not be reused before `stream` is done
+    if isinstance(obj, torch.Tensor):
+        if obj.is_cuda:
+            obj.record_stream(stream)
+    elif isinstance(obj, (list, tuple)):
+        for o in obj:
+            _record_stream(o, stream)
+    elif isinstance(obj, dict):
+        for o in obj.values():
+            _record_stream(o, stream)
+
+
+class ConditioningExecutor:
+    r"""
+    Run the independent conditioning encoders of a generation (T5, CLIP, VAE encoder) concurrently.
+
+    Every task runs in a worker thread on its own CUDA stream, so time-to-first-step drops to the longest task instead
+    of the sum. Tasks are started in submission order as long as the sum of their `memory` estimates stays within
+    `memory_budget`, at least one task always runs. Tasks must use disjoint modules: a module like the Wan VAE keeps
+    its feature cache on the module and cannot run twice at the same time.
+
+    With `concurrent=False`, e.g., when not `supports_concurrent_conditioning(pipe)`, tasks run one after another
+    on the calling thread.
+    """
+
+    def __init__(self, device, concurrent=True, memory_budget=None):
+        self.device = torch.device(device)
+        self.concurrent = concurrent
+        self.memory_budget = memory_budget
+        self._tasks = []
+
+    def submit(self, name, fn, memory=0):
+        self._tasks.append((name, fn, memory))
+
+    def _run_task(self, fn, grad_enabled, main_stream):
+        with torch.set_grad_enabled(grad_enabled):
+            if main_stream is None:
+                return fn(), None
+            stream = torch.cuda.Stream(self.device)
+            stream.wait_stream(main_stream)  # inputs were produced on the main stream
+            with torch.cuda.stream(stream):
+                return fn(), stream
+
+    def run(self):
+        """
+        Run all submitted tasks and return their results by name, ready to use on the current stream.
+        """
+        tasks, self._tasks = self._tasks, []
+        if not self.concurrent or len(tasks) < 2:
+            return {name: fn() for name, fn, _ in tasks}
+
+        grad_enabled = torch.is_grad_enabled()
+        main_stream = torch.cuda.current_stream(self.device) if self.device.type == "cuda" else None
+        results, running = {}, {}
+        with ThreadPoolExecutor(max_workers=len(tasks)) as pool:
+            pending = list(tasks)
+            while pending or running:
+                while pending:
+                    name, fn, memory = pending[0]
+                    in_use = sum(running.values())
+                    if running and self.memory_budget is not None and in_use + memory > self.memory_budget:
+                        break
+                    pending.pop(0)
+                    future = pool.submit(self._run_task, fn, grad_enabled, main_stream)
+                    running[future] = memory
+                    results[name] = future
+                done, _ = wait(list(running), return_when=FIRST_COMPLETED)
+                for future in done:
+                    running.pop(future)
+
+        for name, future in results.items():
+            result, stream = future.result()
+            if stream is not None:
+                main_stream.wait_stream(stream)
+                _record_stream(result, main_stream)
+            results[name] = result
+        return results
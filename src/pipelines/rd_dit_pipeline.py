@@ -11,10 +11,15 @@
 # WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 # See the License for the specific language governing permissions and
 # limitations under the License.
+import contextlib
 import copy
 import html
-from typing import Any, Callable, Dict, List, Optional, Tuple, Union
+import os
+import random
+from dataclasses import dataclass, fields
+from typing import Any, Callable, Dict, Iterable, Iterator, List, Optional, Tuple, Union
 
+import numpy as np
 import regex as re
 import torch
 import torch.nn.functional as F
@@ -32,7 +37,10 @@ from diffusers.utils import is_ftfy_available, is_torch_xla_available, logging,
 from diffusers.utils.torch_utils import randn_tensor
 from diffusers.video_processor import VideoProcessor
 
-from ..models.rd_dit import RealisDanceDiT
+from ..models.rd_dit import RealisDanceDiT, WindowAttnProcessor, pose_foreground_mask
+from ..utils.pose_stream import StreamingPoseEncoder
+from ..utils.video_stream import StreamingVideoDecoder
+from .conditioning import ConditioningExecutor, estimate_vae_encode_memory, supports_concurrent_conditioning
 
 if is_torch_xla_available():
     import torch_xla.core.xla_model as xm
@@ -64,7 +72,8 @@ EXAMPLE_DOC_STRING = """
         ... )
         >>> pipe.enable_model_cpu_offload()
         
-        >>> # prepare ref_image, smpl, hamer, all of them are in shape B C F H W, in range [-1, 1]
+        >>> # prepare ref_image, smpl, hamer, all of them are in shape B C F H W, in range [-1, 1],
+        >>> # or uint8 tensors / arrays in H W C (ref_image) and T H W C (smpl, hamer)
         
         >>> max_res = 768*768
         >>> output = pipe(
@@ -110,6 +119,131 @@ def retrieve_latents(
         raise AttributeError("Could not access latents of provided encoder_output")
 
 
+def compute_target_size(
+    ori_h: int, ori_w: int, max_resolution: int, scale_factor: Tuple[int, int] = (16, 16)
+) -> Tuple[int, int]:
+    """
+    Height and width of about `max_resolution` pixels with the aspect ratio of `ori_h` x `ori_w`, rounded to
+    multiples of `scale_factor` (the VAE scale factor times the patch size).
+    """
+    ratio = (max_resolution / (ori_h * ori_w)) ** 0.5
+    height = round(ori_h * ratio / scale_factor[0]) * scale_factor[0]
+    width = round(ori_w * ratio / scale_factor[1]) * scale_factor[1]
+    return height, width
+
+
+@dataclass
+class RealisDanceDiTState:
+    r"""
+    Denoising state of one generation, i.e., everything the loop of `RealisDanceDiTPipeline.__call__` reads.
+    """
+
+    latents: torch.Tensor
+    i2v_condition: torch.Tensor
+    pose_condition: torch.Tensor
+    ref_condition: torch.Tensor
+    null_ref_condition: Optional[torch.Tensor]
+    prompt_embeds: torch.Tensor
+    negative_prompt_embeds: Optional[torch.Tensor]
+    image_embeds: torch.Tensor
+    null_image_embeds: Optional[torch.Tensor]
+    scheduler: FlowMatchEulerDiscreteScheduler
+    timesteps: torch.Tensor
+    guidance_scale: float
+    enable_teacache: bool = False
+    teacache_kwargs: Optional[Dict[str, Any]] = None
+    teacache_kwargs_uncond: Optional[Dict[str, Any]] = None
+    step: int = 0
+
+    @property
+    def do_classifier_free_guidance(self):
+        return self.guidance_scale > 1
+
+    @property
+    def done(self):
+        return self.step >= len(self.timesteps)
+
+    def save(self, path: str):
+        r"""
+        Save the state at a step boundary, together with the RNG states, so that `load` + `__call__(resume_from=...)`
+        continues bit-exactly (on the same kind of hardware and software stack).
+        """
+        payload = {f.name: _map_tensors(getattr(self, f.name), "cpu") for f in fields(self) if f.name != "scheduler"}
+        payload["scheduler"] = self.scheduler  # pickled as a whole, including its step index
+        payload["rng"] = {
+            "python": random.getstate(),
+            "numpy": np.random.get_state(),
+            "torch": torch.get_rng_state(),
+            "cuda": torch.cuda.get_rng_state_all() if torch.cuda.is_available() else None,
+        }
+        # write then rename, so that a preemption while saving never leaves a broken checkpoint
+        torch.save(payload, path + ".tmp")
+        os.replace(path + ".tmp", path)
+
+    @classmethod
+    def load(cls, path: str, device: Optional[torch.device] = None) -> "RealisDanceDiTState":
+        payload = torch.load(path, map_location="cpu", weights_only=False)
+        rng = payload.pop("rng")
+        random.setstate(rng["python"])
+        np.random.set_state(rng["numpy"])
+        torch.set_rng_state(rng["torch"])
+        if rng["cuda"] is not None and torch.cuda.is_available() and len(rng["cuda"]) == torch.cuda.device_count():
+            torch.cuda.set_rng_state_all(rng["cuda"])
+        state = cls(**payload)
+        if device is not None:
+            state.to(device)
+        return state
+
+    def to(self, device: torch.device) -> "RealisDanceDiTState":
+        r"""
+        Move all tensors, including the scheduler's, to `device` in place, e.g., to hand a prepared generation to a
+        transformer on another device.
+        """
+        for f in fields(self):
+            if f.name != "scheduler":
+                setattr(self, f.name, _map_tensors(getattr(self, f.name), device))
+        for name in ("timesteps", "sigmas"):
+            if isinstance(getattr(self.scheduler, name, None), torch.Tensor):
+                setattr(self.scheduler, name, getattr(self.scheduler, name).to(device))
+        return self
+
+
+def _map_tensors(obj, device):
+    if isinstance(obj, torch.Tensor):
+        return obj.to(device)
+    if isinstance(obj, dict):
+        return {k: _map_tensors(v, device) for k, v in obj.items()}
+    return obj
+
+
+@dataclass
+class RealisDanceDiTPlan:
+    r"""
+    Shape-dependent state of generations at one (height, width, num_frames, num_inference_steps, guidance_scale,
+    ref_size), computed once by `RealisDanceDiTPipeline.plan` and reused by `RealisDanceDiTPipeline.run`.
+    """
+
+    height: int
+    width: int
+    num_frames: int
+    num_inference_steps: int
+    guidance_scale: float
+    ref_size: Tuple[int, int]  # height and width of the encoded reference image
+    scheduler: FlowMatchEulerDiscreteScheduler  # with timesteps set, copied per generation
+    timesteps: torch.Tensor
+    latents_mean: torch.Tensor
+    latents_std: torch.Tensor  # reciprocal, as used to normalize latents
+    i2v_condition: torch.Tensor  # mask + VAE latents of the all-zero condition video, for one sample
+    rotary_emb: torch.Tensor  # of the video and ref tokens, already padded and split for sequence parallelism
+
+    @property
+    def key(self):
+        """
+        Identifies the plan, e.g., as a key for warm-up or compile caches.
+        """
+        return self.height, self.width, self.num_frames, self.num_inference_steps, self.guidance_scale, self.ref_size
+
+
 class RealisDanceDiTPipeline(DiffusionPipeline, WanLoraLoaderMixin):
     r"""
     Pipeline for RealisDance-DiT built upon Wan I2V.
@@ -138,7 +272,8 @@ class RealisDanceDiTPipeline(DiffusionPipeline, WanLoraLoaderMixin):
     """
 
     model_cpu_offload_seq = "text_encoder->image_encoder->transformer->vae"
-    _callback_tensor_inputs = ["latents", "prompt_embeds", "negative_prompt_embeds"]
+    _max_cached_plans = 8
+    _callback_tensor_inputs = ["latents", "prompt_embeds", "negative_prompt_embeds", "x0_pred"]
 
     def __init__(
         self,
@@ -163,8 +298,60 @@ class RealisDanceDiTPipeline(DiffusionPipeline, WanLoraLoaderMixin):
         self.vae_scale_factor_temporal = 2 ** sum(self.vae.temperal_downsample) if getattr(self, "vae", None) else 4
         self.vae_scale_factor_spatial = 2 ** len(self.vae.temperal_downsample) if getattr(self, "vae", None) else 8
         self.video_processor = VideoProcessor(vae_scale_factor=self.vae_scale_factor_spatial)
+        self._plans = {}
+        self.metrics = None
+
+    def prepare_input(
+        self, video: Union[torch.Tensor, np.ndarray], device: torch.device, pin_memory: bool = True
+    ) -> torch.Tensor:
+        """
+        Move an `image` / `smpl` / `hamer` input to `device` in B C F H W.
+
+        uint8 inputs (H W C images, T H W C videos, or B C F H W) stay uint8 here, so only the raw bytes are staged
+        through pinned memory and copied to the device. Normalization happens on the device in `process_shape`.
+        """
+        if isinstance(video, np.ndarray):
+            video = torch.from_numpy(video)
+        if video.dtype == torch.uint8 and video.ndim not in (3, 4, 5):
+            raise ValueError(f"uint8 inputs should be in H W C, T H W C or B C F H W, but got shape {video.shape}.")
+        if video.device.type == "cpu" and torch.device(device).type == "cuda":
+            if pin_memory and not video.is_pinned():
+                video = video.pin_memory()
+            video = video.to(device, non_blocking=True)
+        else:
+            video = video.to(device)
+        # permute on the device, the permuted tensor is only a view
+        if video.dtype == torch.uint8 and video.ndim == 3:  # H W C -> B C 1 H W
+            video = video.permute(2, 0, 1).unsqueeze(0).unsqueeze(2)
+        elif video.dtype == torch.uint8 and video.ndim == 4:  # T H W C -> B C F H W
+            video = video.permute(3, 0, 1, 2).unsqueeze(0)
+        return video
+
+    @staticmethod
+    def _expand_batch(x: Optional[torch.Tensor], batch_size: int) -> Optional[torch.Tensor]:
+        # broadcast a condition encoded once to `batch_size` generations, as a view unless it is already batched
+        if x is None or x.shape[0] == batch_size:
+            return x
+        if x.shape[0] == 1:
+            return x.expand(batch_size, *x.shape[1:])
+        return x.repeat(batch_size // x.shape[0], *([1] * (x.ndim - 1)))
+
+    @staticmethod
+    def _input_size(video: Union[torch.Tensor, np.ndarray]) -> Tuple[int, int]:
+        # height and width of an input in any of the layouts of `prepare_input`, without moving it
+        if video.ndim in (3, 4):  # uint8 H W C or T H W C
+            return tuple(video.shape[-3:-1])
+        return tuple(video.shape[-2:])
+
+    @staticmethod
+    def _normalize(video: torch.Tensor) -> torch.Tensor:
+        if video.dtype == torch.uint8:
+            # [0, 255] -> [-1, 1]
+            video = video.to(torch.float32) / 127.5 - 1
+        return video
 
     def process_shape(self, video: torch.Tensor, tgt_h: int, tgt_w: int, resize_type: str) -> torch.Tensor:
+        video = self._normalize(video)
         num_frame, ori_h, ori_w = video.shape[-3:]
         if resize_type == "max_resolution":
             ratio = ((tgt_h * tgt_w) / (ori_h * ori_w)) ** 0.5
@@ -176,6 +363,8 @@ class RealisDanceDiTPipeline(DiffusionPipeline, WanLoraLoaderMixin):
             tgt_h = h
             tgt_w = w
         elif resize_type == "resize_crop":
+            if (ori_h, ori_w) == (tgt_h, tgt_w):  # e.g., pre-resized inputs from a pose bundle
+                return video
             ratio_h, ratio_w = tgt_h / ori_h, tgt_w / ori_w
             if ratio_h > ratio_w:
                 h, w = tgt_h, round(ori_w * ratio_h)
@@ -254,11 +443,15 @@ class RealisDanceDiTPipeline(DiffusionPipeline, WanLoraLoaderMixin):
 
     def encode_image(
         self,
-        image: torch.Tensor,
+        image: Union[torch.Tensor, List[torch.Tensor]],
         device: Optional[torch.device] = None,
     ):
         device = device or self._execution_device
-        image = self._image_trans_for_clip(image).to(device=device)
+        if isinstance(image, (list, tuple)):  # images of different sizes in one forward
+            image = torch.cat([self._image_trans_for_clip(im) for im in image])
+        else:
+            image = self._image_trans_for_clip(image)
+        image = image.to(device=device)
         image_embeds = self.image_encoder(pixel_values=image, output_hidden_states=True)
         return image_embeds.hidden_states[-2]
 
@@ -356,13 +549,18 @@ class RealisDanceDiTPipeline(DiffusionPipeline, WanLoraLoaderMixin):
         prompt_embeds=None,
         negative_prompt_embeds=None,
         callback_on_step_end_tensor_inputs=None,
+        pose_latents=None,
     ):
-        if image is not None and not isinstance(image, torch.Tensor):
-            raise ValueError(f"`image` has to be of type `torch.Tensor` but is {type(image)}")
-        if smpl is not None and not isinstance(smpl, torch.Tensor):
-            raise ValueError(f"`smpl` has to be of type `torch.Tensor` but is {type(smpl)}")
-        if hamer is not None and not isinstance(hamer, torch.Tensor):
-            raise ValueError(f"`hamer` has to be of type `torch.Tensor` but is {type(hamer)}")
+        if pose_latents is None and (smpl is None or hamer is None):
+            raise ValueError("Provide either `smpl` and `hamer` or `pose_latents`.")
+        if pose_latents is not None and (height is None or width is None):
+            raise ValueError("`height` and `width` are required when passing `pose_latents`.")
+        if image is not None and not isinstance(image, (torch.Tensor, np.ndarray)):
+            raise ValueError(f"`image` has to be of type `torch.Tensor` or `np.ndarray` but is {type(image)}")
+        if smpl is not None and not isinstance(smpl, (torch.Tensor, np.ndarray)):
+            raise ValueError(f"`smpl` has to be of type `torch.Tensor` or `np.ndarray` but is {type(smpl)}")
+        if hamer is not None and not isinstance(hamer, (torch.Tensor, np.ndarray)):
+            raise ValueError(f"`hamer` has to be of type `torch.Tensor` or `np.ndarray` but is {type(hamer)}")
         if height is not None and width is not None and (height % 16 != 0 or width % 16 != 0):
             raise ValueError(f"`height` and `width` have to be divisible by 16 but are {height} and {width}.")
 
@@ -408,6 +606,9 @@ class RealisDanceDiTPipeline(DiffusionPipeline, WanLoraLoaderMixin):
         device: Optional[torch.device] = None,
         generator: Optional[Union[torch.Generator, List[torch.Generator]]] = None,
         latents: Optional[torch.Tensor] = None,
+        pose_latents: Optional[torch.Tensor] = None,
+        batch_vae_encode: bool = False,
+        plan: Optional[RealisDanceDiTPlan] = None,
     ) -> Tuple[torch.Tensor, torch.Tensor, torch.Tensor, torch.Tensor, torch.Tensor]:
         num_latent_frames = (num_frames - 1) // self.vae_scale_factor_temporal + 1
         latent_height = height // self.vae_scale_factor_spatial
@@ -426,60 +627,138 @@ class RealisDanceDiTPipeline(DiffusionPipeline, WanLoraLoaderMixin):
             latents = latents.to(device=device, dtype=dtype)
 
         image = image.to(device=device, dtype=dtype)
-        video_condition = torch.zeros(
-            image.shape[0], image.shape[1], num_frames, height, width
-        )
-        video_condition = video_condition.to(device=device, dtype=dtype)
-        smpl = smpl.to(device=device, dtype=dtype)
-        hamer = hamer.to(device=device, dtype=dtype)
+        if pose_latents is None:
+            smpl = smpl.to(device=device, dtype=dtype)
+            hamer = hamer.to(device=device, dtype=dtype)
+
+        if plan is not None:
+            latents_mean, latents_std = plan.latents_mean, plan.latents_std
+        else:
+            latents_mean, latents_std = self._get_latents_norm(latents.device, latents.dtype)
+
+        videos = {}
+        if plan is None:
+            videos["condition"] = torch.zeros(
+                image.shape[0], image.shape[1], num_frames, height, width, device=device, dtype=dtype
+            )
+        if pose_latents is None:
+            videos["smpl"] = smpl
+            videos["hamer"] = hamer
+        videos["ref"] = image
+        if self.do_classifier_free_guidance:
+            videos["null_ref"] = torch.zeros_like(image)
+        # the condition latents are the posterior mode, the same for every generator, so encode once and broadcast
+        encoded = {
+            k: self._expand_batch((v - latents_mean) * latents_std, batch_size)
+            for k, v in self._vae_encode(videos, batch=batch_vae_encode).items()
+        }
+        if pose_latents is None:
+            latent_smpl = encoded["smpl"]
+            latent_hamer = encoded["hamer"]
+        latent_ref = encoded["ref"]
+        latent_null_ref = encoded.get("null_ref")
+
+        if plan is not None:
+            latent_i2v_condition = self._expand_batch(plan.i2v_condition, batch_size)
+        else:
+            latent_condition = encoded["condition"][:1]
+            mask_lat_size = torch.zeros(1, 4, num_latent_frames, latent_height, latent_width)
+            mask_lat_size = mask_lat_size.to(latent_condition.device)
+            latent_i2v_condition = torch.cat(
+                [mask_lat_size, latent_condition], dim=1
+            )
+            latent_i2v_condition = self._expand_batch(latent_i2v_condition, batch_size)
+
+        if pose_latents is None:
+            latent_pose = torch.cat((latent_smpl, latent_hamer), dim=1)
+        else:
+            # already normalized, e.g., from `StreamingPoseEncoder`
+            latent_pose = self._expand_batch(pose_latents.to(device=device, dtype=dtype), batch_size)
+
+        return latents, latent_i2v_condition, latent_pose, latent_ref, latent_null_ref
+
+    def get_target_size(self, ori_h: int, ori_w: int, max_resolution: int) -> Tuple[int, int]:
+        """
+        Generation height and width for a pose video of `ori_h` x `ori_w` at `max_resolution` pixels.
+        """
+        patch_size = self.transformer.config.patch_size
+        scale_factor = (self.vae_scale_factor_spatial * patch_size[1], self.vae_scale_factor_spatial * patch_size[2])
+        return compute_target_size(ori_h, ori_w, max_resolution, scale_factor)
+
+    def _round_num_frames(self, num_frames: int) -> int:
+        if num_frames % self.vae_scale_factor_temporal != 1:
+            logger.warning(
+                f"`num_frames - 1` has to be divisible by {self.vae_scale_factor_temporal}. Rounding to the nearest number."
+            )
+            num_frames = num_frames // self.vae_scale_factor_temporal * self.vae_scale_factor_temporal + 1
+        return max(num_frames, 1)
 
+    def _get_latents_norm(self, device: torch.device, dtype: torch.dtype) -> Tuple[torch.Tensor, torch.Tensor]:
+        # mean and reciprocal std of the VAE latents
         latents_mean = (
             torch.tensor(self.vae.config.latents_mean)
             .view(1, self.vae.config.z_dim, 1, 1, 1)
-            .to(latents.device, latents.dtype)
+            .to(device, dtype)
         )
         latents_std = 1.0 / torch.tensor(self.vae.config.latents_std).view(1, self.vae.config.z_dim, 1, 1, 1).to(
-            latents.device, latents.dtype
+            device, dtype
         )
-
-        if isinstance(generator, list):
-            def vae_encode_1(x):
-                latent_x = [
-                    retrieve_latents(self.vae.encode(x), sample_mode="argmax") for _ in generator
-                ]
-                return (torch.cat(latent_x) - latents_mean) * latents_std
-
-            latent_condition = vae_encode_1(video_condition)
-            latent_smpl = vae_encode_1(smpl)
-            latent_hamer = vae_encode_1(hamer)
-            latent_ref = vae_encode_1(image)
-            if self.do_classifier_free_guidance:
-                latent_null_ref = vae_encode_1(torch.zeros_like(image))
-            else:
-                latent_null_ref = None
+        return latents_mean, latents_std
+
+    def _get_teacache_kwargs(
+        self, enable_teacache: bool, teacache_thresh: float, use_timestep_proj: bool, num_inference_steps: int
+    ) -> Tuple[Optional[Dict[str, Any]], Optional[Dict[str, Any]]]:
+        # initial TeaCache state of the conditional and the unconditional branch
+        if not enable_teacache:
+            return None, None
+        teacache_kwargs = {
+            "teacache_thresh": teacache_thresh,
+            "accumulated_rel_l1_distance": 0,
+            "previous_e0": None,
+            "previous_residual": None,
+            "use_timestep_proj": use_timestep_proj,
+            "coefficients": [
+                8.10705460e+03, 2.13393892e+03, -3.72934672e+02, 1.66203073e+01, -4.17769401e-02
+            ] if use_timestep_proj else[
+                -114.36346466, 65.26524496, -18.82220707, 4.91518089, -0.23412683
+            ],
+            "ret_steps": 5 if use_timestep_proj else 1,
+            "cutoff_steps": num_inference_steps
+        }
+        teacache_kwargs_uncond = copy.deepcopy(teacache_kwargs) if self.do_classifier_free_guidance else None
+        return teacache_kwargs, teacache_kwargs_uncond
+
+    def _vae_encode(self, videos: Dict[str, torch.Tensor], batch: bool = False) -> Dict[str, torch.Tensor]:
+        """
+        VAE-encode several videos to their posterior mode. With `batch`, videos of the same shape share one encode.
+        """
+        if not batch:
+            return {k: retrieve_latents(self.vae.encode(v), sample_mode="argmax") for k, v in videos.items()}
+        groups = {}
+        for k, v in videos.items():
+            groups.setdefault(tuple(v.shape[1:]), []).append(k)
+        encoded = {}
+        for keys in groups.values():
+            latents = retrieve_latents(self.vae.encode(torch.cat([videos[k] for k in keys])), sample_mode="argmax")
+            encoded.update(zip(keys, latents.split([videos[k].shape[0] for k in keys])))
+        return {k: encoded[k] for k in videos}
+
+    def decode_latents(
+        self, latents: torch.Tensor, output_type: str = "np", plan: Optional[RealisDanceDiTPlan] = None
+    ):
+        if output_type == "latent":
+            return latents
+        latents = latents.to(self.vae.dtype)
+        if plan is not None and plan.latents_mean.device == latents.device:
+            latents_mean, latents_std = plan.latents_mean.to(latents.dtype), plan.latents_std.to(latents.dtype)
         else:
-            def vae_encode_2(x):
-                latent_x = retrieve_latents(self.vae.encode(x), sample_mode="argmax")
-                return (latent_x.repeat(batch_size, 1, 1, 1, 1) - latents_mean) * latents_std
-
-            latent_condition = vae_encode_2(video_condition)
-            latent_smpl = vae_encode_2(smpl)
-            latent_hamer = vae_encode_2(hamer)
-            latent_ref = vae_encode_2(image)
-            if self.do_classifier_free_guidance:
-                latent_null_ref = vae_encode_2(torch.zeros_like(image))
-            else:
-                latent_null_ref = None
-
-        mask_lat_size = torch.zeros(batch_size, 4, num_latent_frames, latent_height, latent_width)
-        mask_lat_size = mask_lat_size.to(latent_condition.device)
-        latent_i2v_condition = torch.cat(
-            [mask_lat_size, latent_condition], dim=1
-        )
-
-        latent_pose = torch.cat((latent_smpl, latent_hamer), dim=1)
-
-        return latents, latent_i2v_condition, latent_pose, latent_ref, latent_null_ref
+            latents_mean, latents_std = self._get_latents_norm(latents.device, latents.dtype)
+        latents = latents / latents_std + latents_mean
+        with self._time_stage("decode", latents.device):
+            # one video at a time, e.g., for variants, so decoding needs as much memory as for a single video
+            video = torch.cat([self.vae.decode(sample, return_dict=False)[0] for sample in latents.split(1)])
+        video = self.video_processor.postprocess_video(video, output_type=output_type)
+        return video
 
     @property
     def guidance_scale(self):
@@ -505,13 +784,897 @@ class RealisDanceDiTPipeline(DiffusionPipeline, WanLoraLoaderMixin):
     def attention_kwargs(self):
         return self._attention_kwargs
 
+    def enable_metrics(self, registry):
+        r"""
+        Report stage latencies, TeaCache decisions and cache hits to a `MetricsRegistry`. Stage timers synchronize
+        the device, so only enable metrics when they are collected.
+        """
+        self.metrics = registry
+
+    def _time_stage(self, stage: str, device: Optional[torch.device] = None):
+        if self.metrics is None:
+            return contextlib.nullcontext()
+        return self.metrics.time_stage(stage, device or self._execution_device)
+
+    @torch.no_grad()
+    def plan(
+        self,
+        height: int,
+        width: int,
+        num_frames: int = 81,
+        num_inference_steps: int = 40,
+        guidance_scale: float = 2.0,
+        ref_size: Optional[Tuple[int, int]] = None,
+    ) -> RealisDanceDiTPlan:
+        r"""
+        Precompute the shape-dependent state of generations: scheduler timesteps, latent normalization, the encoded
+        i2v condition and the RoPE table. Plans are cached per `RealisDanceDiTPlan.key`, pass the result to `run`.
+        Use `get_target_size` to get `height` and `width` from a pose video and a max resolution. The reference
+        keeps its aspect ratio, pass its encoded size `ref_size` from `get_ref_size`, the video size by default.
+        """
+        ref_size = tuple(ref_size) if ref_size is not None else (height, width)
+        if height % 16 != 0 or width % 16 != 0 or ref_size[0] % 16 != 0 or ref_size[1] % 16 != 0:
+            raise ValueError(
+                f"`height`, `width` and `ref_size` have to be divisible by 16 but are {height}, {width} and {ref_size}."
+            )
+        num_frames = self._round_num_frames(num_frames)
+        key = (height, width, num_frames, num_inference_steps, guidance_scale, ref_size)
+        if self.metrics is not None:
+            self.metrics.inc_cache("plan", key in self._plans)
+        if key in self._plans:
+            return self._plans[key]
+
+        device = self._execution_device
+        scheduler = copy.deepcopy(self.scheduler)
+        scheduler.set_timesteps(num_inference_steps, device=device)
+        latents_mean, latents_std = self._get_latents_norm(device, torch.float32)
+
+        # the i2v condition video is all zeros, its latents only depend on the shape
+        video_condition = torch.zeros(1, 3, num_frames, height, width, device=device, dtype=self.vae.dtype)
+        latent_condition = retrieve_latents(self.vae.encode(video_condition), sample_mode="argmax")
+        latent_condition = (latent_condition.to(torch.float32) - latents_mean) * latents_std
+        mask_lat_size = latent_condition.new_zeros(1, 4, *latent_condition.shape[2:])
+        i2v_condition = torch.cat([mask_lat_size, latent_condition], dim=1)
+
+        # RoPE only reads shapes, empty tensors are enough
+        latent_shape = latent_condition.shape[2:]
+        ref_latent_size = (ref_size[0] // self.vae_scale_factor_spatial, ref_size[1] // self.vae_scale_factor_spatial)
+        rotary_emb = self.transformer.prepare_rotary_emb(
+            torch.empty(1, 0, *latent_shape, device=device), torch.empty(1, 0, 1, *ref_latent_size, device=device)
+        )
+
+        plan = RealisDanceDiTPlan(
+            height=height,
+            width=width,
+            num_frames=num_frames,
+            num_inference_steps=num_inference_steps,
+            guidance_scale=guidance_scale,
+            ref_size=ref_size,
+            scheduler=scheduler,
+            timesteps=scheduler.timesteps,
+            latents_mean=latents_mean,
+            latents_std=latents_std,
+            i2v_condition=i2v_condition,
+            rotary_emb=rotary_emb,
+        )
+        if len(self._plans) >= self._max_cached_plans:
+            self._plans.pop(next(iter(self._plans)))  # the oldest, each plan holds a RoPE table on the device
+        self._plans[key] = plan
+        return plan
+
+    def get_ref_size(self, image: Union[torch.Tensor, np.ndarray], height: int, width: int) -> Tuple[int, int]:
+        """
+        Encoded size of a reference `image` for a `height` x `width` generation: its own aspect ratio at the area of
+        the video, see `process_shape(..., resize_type="max_resolution")`.
+        """
+        return self.get_target_size(*self._input_size(image), height * width)
+
+    def _plan_rotary_emb(
+        self, plan: Optional[RealisDanceDiTPlan], ref_condition: torch.Tensor
+    ) -> Optional[torch.Tensor]:
+        # the planned RoPE table if it fits the ref tokens, otherwise the transformer computes it
+        if plan is None:
+            return None
+        ref_latent_size = tuple(size // self.vae_scale_factor_spatial for size in plan.ref_size)
+        if tuple(ref_condition.shape[-2:]) != ref_latent_size:
+            logger.warning(
+                f"The plan is for a {plan.ref_size} reference, but the reference latents are "
+                f"{tuple(ref_condition.shape[-2:])}. Pass `ref_size` to `plan`."
+            )
+            return None
+        return plan.rotary_emb
+
+    def run(self, plan: RealisDanceDiTPlan, **kwargs):
+        r"""
+        Generate with the precomputed state of `plan`. Takes the arguments of `__call__` except the ones fixed by the
+        plan (`height`, `width`, `max_resolution`, `num_frames`, `num_inference_steps`, `guidance_scale`).
+        """
+        fixed = {"height", "width", "max_resolution", "num_frames", "num_inference_steps", "guidance_scale"}
+        if fixed & kwargs.keys():
+            raise ValueError(f"{sorted(fixed & kwargs.keys())} are fixed by the plan.")
+        return self(plan=plan, **kwargs)
+
+    @torch.no_grad()
+    def fan_out(
+        self,
+        image: Union[torch.Tensor, np.ndarray, List[Union[torch.Tensor, np.ndarray]]],
+        smpl: Union[torch.Tensor, np.ndarray, List[Union[torch.Tensor, np.ndarray]]],
+        hamer: Union[torch.Tensor, np.ndarray, List[Union[torch.Tensor, np.ndarray]]],
+        prompt: str,
+        negative_prompt: Optional[str] = None,
+        max_resolution: int = 768 * 768,
+        num_frames: int = 81,
+        num_inference_steps: int = 40,
+        guidance_scale: float = 2.0,
+        generator: Optional[torch.Generator] = None,
+        max_batch_size: int = 4,
+        output_type: Optional[str] = "np",
+        attention_kwargs: Optional[Dict[str, Any]] = None,
+        max_sequence_length: int = 512,
+        enable_teacache: bool = False,
+        teacache_thresh: float = 0.2,
+        use_timestep_proj: bool = True,
+    ) -> List[Any]:
+        r"""
+        Animate many reference images with one pose sequence (`image` is a list), or one reference image with many
+        pose sequences (`smpl` and `hamer` are lists of the same length).
+
+        The shared side is encoded once: the prompt, the null image, and either the pose latents or the reference
+        latents and CLIP embeddings. The varying side is encoded and denoised in batches of up to `max_batch_size`
+        generations of the same shape, all batch members reuse the shared tensors as broadcast views. Videos are
+        decoded one by one and returned in input order. See `__call__` for the other arguments.
+        """
+        fan_out_refs = isinstance(image, (list, tuple))
+        fan_out_poses = isinstance(smpl, (list, tuple)) or isinstance(hamer, (list, tuple))
+        if fan_out_refs == fan_out_poses:
+            raise ValueError("Pass either a list of `image`s, or lists of `smpl`s and `hamer`s, but not both.")
+        if fan_out_poses and not (
+            isinstance(smpl, (list, tuple)) and isinstance(hamer, (list, tuple)) and len(smpl) == len(hamer)
+        ):
+            raise ValueError("`smpl` and `hamer` have to be lists of the same length.")
+        if not isinstance(prompt, str) or (negative_prompt is not None and not isinstance(negative_prompt, str)):
+            raise ValueError("`prompt` and `negative_prompt` have to be of type `str`, they are shared by all videos.")
+
+        device = self._execution_device
+        num_frames = self._round_num_frames(num_frames)
+        self._guidance_scale = guidance_scale
+        transformer_dtype = self.transformer.dtype
+        latents_mean, latents_std = self._get_latents_norm(device, torch.float32)
+
+        def encode_videos(videos):
+            return {k: (v - latents_mean) * latents_std for k, v in self._vae_encode(videos, batch=True).items()}
+
+        # 1. Shared side: the prompt and the null image, the CLIP input is 224 x 224 whatever the image size
+        prompt_embeds, negative_prompt_embeds = self.encode_prompt(
+            prompt=prompt,
+            negative_prompt=negative_prompt,
+            do_classifier_free_guidance=self.do_classifier_free_guidance,
+            max_sequence_length=max_sequence_length,
+            device=device,
+        )
+        prompt_embeds = prompt_embeds.to(transformer_dtype)
+        if negative_prompt_embeds is not None:
+            negative_prompt_embeds = negative_prompt_embeds.to(transformer_dtype)
+        if fan_out_poses:
+            ref_image = self._normalize(self.prepare_input(image, device))
+            image_embeds = self.encode_image(ref_image, device).to(transformer_dtype)
+        null_image_embeds = None
+        if self.do_classifier_free_guidance:
+            null_image = torch.zeros(1, 3, 1, 224, 224, device=device)
+            null_image_embeds = self.encode_image(null_image, device).to(transformer_dtype)
+
+        # 2. Group the videos by generation and reference shape, each group shares a plan
+        groups = {}
+        if fan_out_refs:
+            height, width = self.get_target_size(*self._input_size(smpl), max_resolution)
+            for i, im in enumerate(image):
+                # the reference keeps its aspect ratio at the generation area, see `get_ref_size`
+                groups.setdefault((height, width, self.get_ref_size(im, height, width)), []).append(i)
+            smpl = self.process_shape(self.prepare_input(smpl, device), height, width, resize_type="resize_crop")
+            hamer = self.process_shape(self.prepare_input(hamer, device), height, width, resize_type="resize_crop")
+            encoded = encode_videos({"smpl": smpl.to(torch.float32), "hamer": hamer.to(torch.float32)})
+            latent_pose = torch.cat([encoded["smpl"], encoded["hamer"]], dim=1).to(transformer_dtype)
+        else:
+            for i, s in enumerate(smpl):
+                height, width = self.get_target_size(*self._input_size(s), max_resolution)
+                groups.setdefault((height, width, self.get_ref_size(image, height, width)), []).append(i)
+
+        videos = [None] * (len(image) if fan_out_refs else len(smpl))
+        for (height, width, ref_size), indices in groups.items():
+            # the RoPE table of the plan covers the ref tokens of the group
+            plan = self.plan(height, width, num_frames, num_inference_steps, guidance_scale, ref_size=ref_size)
+            latent_null_ref = None
+            if fan_out_poses:
+                ref = self.process_shape(ref_image, height, width, resize_type="max_resolution").to(torch.float32)
+                refs = {"ref": ref}
+                if self.do_classifier_free_guidance:
+                    refs["null_ref"] = torch.zeros_like(ref)
+                encoded = encode_videos(refs)
+                latent_ref = encoded["ref"].to(transformer_dtype)
+                if self.do_classifier_free_guidance:
+                    latent_null_ref = encoded["null_ref"].to(transformer_dtype)
+            elif self.do_classifier_free_guidance:
+                null_ref = torch.zeros(1, 3, 1, *ref_size, device=device)
+                latent_null_ref = encode_videos({"null_ref": null_ref})["null_ref"].to(transformer_dtype)
+
+            # 3. Varying side, batch by batch
+            for start in range(0, len(indices), max_batch_size):
+                batch = indices[start:start + max_batch_size]
+                batch_size = len(batch)
+                if fan_out_refs:
+                    images = [self._normalize(self.prepare_input(image[i], device)) for i in batch]
+                    batch_image_embeds = self.encode_image(images, device).to(transformer_dtype)
+                    encoded = encode_videos({
+                        i: self.process_shape(im, height, width, resize_type="max_resolution").to(torch.float32)
+                        for i, im in zip(batch, images)
+                    })
+                    batch_ref = torch.cat([encoded[i] for i in batch]).to(transformer_dtype)
+                    batch_pose = self._expand_batch(latent_pose, batch_size)
+                else:
+                    poses = {}
+                    for i in batch:
+                        for name, video in (("smpl", smpl[i]), ("hamer", hamer[i])):
+                            video = self.prepare_input(video, device)
+                            video = self.process_shape(video, height, width, resize_type="resize_crop")
+                            poses[(name, i)] = video.to(torch.float32)
+                    encoded = encode_videos(poses)
+                    batch_pose = torch.cat(
+                        [torch.cat([encoded[("smpl", i)], encoded[("hamer", i)]], dim=1) for i in batch]
+                    ).to(transformer_dtype)
+                    batch_image_embeds = self._expand_batch(image_embeds, batch_size)
+                    batch_ref = self._expand_batch(latent_ref, batch_size)
+
+                shape = (batch_size, self.vae.config.z_dim, *plan.i2v_condition.shape[2:])
+                latents = randn_tensor(shape, generator=generator, device=device, dtype=torch.float32)
+                teacache_kwargs, teacache_kwargs_uncond = self._get_teacache_kwargs(
+                    enable_teacache, teacache_thresh, use_timestep_proj, num_inference_steps
+                )
+                state = RealisDanceDiTState(
+                    latents=latents,
+                    i2v_condition=self._expand_batch(plan.i2v_condition, batch_size),
+                    pose_condition=batch_pose,
+                    ref_condition=batch_ref,
+                    null_ref_condition=self._expand_batch(latent_null_ref, batch_size),
+                    prompt_embeds=self._expand_batch(prompt_embeds, batch_size),
+                    negative_prompt_embeds=self._expand_batch(negative_prompt_embeds, batch_size),
+                    image_embeds=batch_image_embeds,
+                    null_image_embeds=self._expand_batch(null_image_embeds, batch_size),
+                    scheduler=copy.copy(plan.scheduler),
+                    timesteps=plan.timesteps,
+                    guidance_scale=guidance_scale,
+                    enable_teacache=enable_teacache,
+                    teacache_kwargs=teacache_kwargs,
+                    teacache_kwargs_uncond=teacache_kwargs_uncond,
+                )
+                latents = self(
+                    resume_from=state, plan=plan, attention_kwargs=attention_kwargs, output_type="latent"
+                ).frames
+                for i, video in zip(batch, self.decode_latents(latents, output_type=output_type, plan=plan)):
+                    videos[i] = video
+        return videos
+
+    @staticmethod
+    def _window_weights(size: int, window: int, overlap: int) -> List[Tuple[int, torch.Tensor]]:
+        """
+        Start and blend weight (over the `window` latent positions) of every window along one latent axis of `size`,
+        e.g., temporal windows or spatial tiles. Windows are spaced by `window - overlap`, the last one is aligned to
+        the end. Weights ramp linearly across the overlaps, so the predictions of neighboring windows cross-fade
+        instead of meeting at a seam.
+        """
+        if size <= window:
+            return [(0, torch.ones(size))]
+        starts = list(range(0, size - window, window - overlap)) + [size - window]
+        ramp = torch.arange(1, overlap + 1, dtype=torch.float32) / (overlap + 1)
+        windows = []
+        for start in starts:
+            weight = torch.ones(window)
+            if start > 0:
+                weight[:overlap] = ramp
+            if start + window < size:
+                weight[-overlap:] = ramp.flip(0)
+            windows.append((start, weight))
+        return windows
+
+    def _predict_window(
+        self,
+        state: RealisDanceDiTState,
+        latents: torch.Tensor,
+        i2v_condition: torch.Tensor,
+        pose_condition: torch.Tensor,
+        t: torch.Tensor,
+        rotary_emb: torch.Tensor,
+        attention_kwargs: Optional[Dict[str, Any]] = None,
+    ) -> torch.Tensor:
+        # guided noise prediction of a temporal window or a spatial tile, with the shared conditions of `state`
+        latent_model_input = torch.cat([latents, i2v_condition], dim=1).to(self.transformer.dtype)
+        timestep = t.expand(latents.shape[0])
+        noise_pred = self.transformer(
+            hidden_states=latent_model_input,
+            timestep=timestep,
+            encoder_hidden_states=state.prompt_embeds,
+            encoder_hidden_states_image=state.image_embeds,
+            attention_kwargs=attention_kwargs,
+            return_dict=False,
+            add_cond=pose_condition,
+            attn_cond=state.ref_condition,
+            rotary_emb=rotary_emb,
+        )[0]
+        if self.do_classifier_free_guidance:
+            noise_uncond = self.transformer(
+                hidden_states=latent_model_input,
+                timestep=timestep,
+                encoder_hidden_states=state.negative_prompt_embeds,
+                encoder_hidden_states_image=state.null_image_embeds,
+                attention_kwargs=attention_kwargs,
+                return_dict=False,
+                add_cond=pose_condition,
+                attn_cond=state.null_ref_condition,
+                rotary_emb=rotary_emb,
+            )[0]
+            noise_pred = noise_uncond + state.guidance_scale * (noise_pred - noise_uncond)
+        return noise_pred.float()
+
+    def _prepare_tiles(
+        self, latents: torch.Tensor, ref_condition: torch.Tensor, tile_size: int, tile_overlap: int
+    ) -> Tuple[List[Tuple[int, int, torch.Tensor, torch.Tensor]], torch.Tensor]:
+        # (row, column, blend weight, RoPE) of every spatial tile in latent units, and the summed weights
+        _, _, num_latent_frames, height, width = latents.shape
+        tile = tile_size // self.vae_scale_factor_spatial
+        overlap = tile_overlap // self.vae_scale_factor_spatial
+        tile_h, tile_w = min(tile, height), min(tile, width)
+        tiles = []
+        total_weight = latents.new_zeros(1, 1, 1, height, width)
+        for row, weight_h in self._window_weights(height, tile_h, overlap):
+            for col, weight_w in self._window_weights(width, tile_w, overlap):
+                weight = (weight_h[:, None] * weight_w[None, :]).to(latents.device).view(1, 1, 1, tile_h, tile_w)
+                rotary_emb = self.transformer.prepare_rotary_emb(
+                    torch.empty(1, 0, num_latent_frames, tile_h, tile_w, device=latents.device),
+                    torch.empty(1, 0, *ref_condition.shape[2:], device=latents.device),
+                    offset=(row, col),
+                    canvas_size=(height, width),
+                )
+                tiles.append((row, col, weight, rotary_emb))
+                total_weight[..., row:row + tile_h, col:col + tile_w] += weight
+        return tiles, total_weight
+
+    def _downsample_latents(self, latents: Optional[torch.Tensor], factor: int) -> Optional[torch.Tensor]:
+        # B C F H W -> the mean of every `factor` x `factor` patch, cut to whole transformer patches
+        if latents is None:
+            return None
+        p_h, p_w = self.transformer.config.patch_size[1:]
+        height = latents.shape[3] // factor // p_h * p_h
+        width = latents.shape[4] // factor // p_w * p_w
+        size = (latents.shape[2], height, width)
+        return F.interpolate(latents.float(), size=size, mode="area").to(latents.dtype)
+
+    def _region_mask(self, pose_condition: torch.Tensor, dilation: int) -> Tuple[torch.Tensor, torch.Tensor]:
+        """
+        The video tokens of the character, dilated by `dilation` tokens and joined over the batch: their indices,
+        and the B C F H W latent mask they cover.
+        """
+        p_t, p_h, p_w = self.transformer.config.patch_size
+        num_frames, height, width = pose_condition.shape[2:]
+        token_mask = pose_foreground_mask(pose_condition, (p_t, p_h, p_w), dilation=dilation).any(dim=0)
+        latent_mask = token_mask.view(num_frames // p_t, height // p_h, width // p_w)
+        latent_mask = latent_mask.repeat_interleave(p_t, 0).repeat_interleave(p_h, 1).repeat_interleave(p_w, 2)
+        return token_mask.nonzero().squeeze(1), latent_mask[None, None]
+
+    def _predict_tiled(
+        self,
+        state: RealisDanceDiTState,
+        latents: torch.Tensor,
+        t: torch.Tensor,
+        tiles: List[Tuple[int, int, torch.Tensor, torch.Tensor]],
+        total_weight: torch.Tensor,
+        attention_kwargs: Optional[Dict[str, Any]] = None,
+    ) -> torch.Tensor:
+        # every tile attends to its own tokens and all ref tokens, the tile predictions are blended over the overlaps
+        noise_pred = torch.zeros_like(latents, dtype=torch.float32)
+        for row, col, weight, rotary_emb in tiles:
+            rows, cols = slice(row, row + weight.shape[3]), slice(col, col + weight.shape[4])
+            tile_pred = self._predict_window(
+                state,
+                latents[..., rows, cols],
+                state.i2v_condition[..., rows, cols],
+                state.pose_condition[..., rows, cols],
+                t,
+                rotary_emb,
+                attention_kwargs,
+            )
+            noise_pred[..., rows, cols] += tile_pred * weight
+        return noise_pred / total_weight
+
+    @torch.no_grad()
+    def generate_long(
+        self,
+        image: Union[torch.Tensor, np.ndarray],
+        smpl: Optional[Union[torch.Tensor, np.ndarray]] = None,
+        hamer: Optional[Union[torch.Tensor, np.ndarray]] = None,
+        prompt: str = None,
+        negative_prompt: Optional[str] = None,
+        height: Optional[int] = None,
+        width: Optional[int] = None,
+        max_resolution: int = 768 * 768,
+        window_frames: int = 81,
+        window_overlap: int = 16,
+        num_inference_steps: int = 40,
+        guidance_scale: float = 2.0,
+        generator: Optional[torch.Generator] = None,
+        output_type: Optional[str] = "np",
+        return_dict: bool = True,
+        attention_kwargs: Optional[Dict[str, Any]] = None,
+        max_sequence_length: int = 512,
+        pose_latents: Optional[torch.Tensor] = None,
+    ):
+        r"""
+        Animate a pose sequence of any length with overlapping temporal windows of `window_frames` frames.
+
+        The whole clip is denoised at once, one step at a time: at every step, the transformer runs on each window of
+        latent frames, and the noise predictions are blended over the `window_overlap` frames shared by neighboring
+        windows before the scheduler steps the full latents. The prompt, the reference image and the pose are encoded
+        once, the pose chunk by chunk with `StreamingPoseEncoder`; all windows share the plan of one window, so RoPE
+        positions, the i2v condition and the attention cost stay the ones of a single `window_frames` generation,
+        whatever the clip length. With multiple GPUs, every window is sequence parallel as in `__call__`. Frames are
+        decoded one latent frame at a time and returned on the host.
+
+        Args:
+            smpl, hamer (`torch.Tensor` or `np.ndarray`):
+                uint8 pose videos in T H W C of the full clip, or `pose_latents` of the full clip with `height` and
+                `width`, e.g., from `encode_pose_stream`. The clip is cut to `4k + 1` frames.
+            window_frames (`int`, defaults to `81`):
+                Frames per window, `4k + 1`.
+            window_overlap (`int`, defaults to `16`):
+                Frames shared by neighboring windows, a multiple of 4.
+        See `__call__` for the other arguments, TeaCache and step callbacks are not supported.
+        """
+        if pose_latents is None and (smpl is None or hamer is None):
+            raise ValueError("Provide either `smpl` and `hamer` or `pose_latents`.")
+        if pose_latents is not None and (height is None or width is None):
+            raise ValueError("`height` and `width` are required when passing `pose_latents`.")
+        if not isinstance(prompt, str) or (negative_prompt is not None and not isinstance(negative_prompt, str)):
+            raise ValueError("`prompt` and `negative_prompt` have to be of type `str`, they are shared by all windows.")
+        window_frames = self._round_num_frames(window_frames)
+        window = (window_frames - 1) // self.vae_scale_factor_temporal + 1
+        overlap = window_overlap // self.vae_scale_factor_temporal
+        if window_overlap % self.vae_scale_factor_temporal != 0 or not 0 < overlap < window:
+            raise ValueError(
+                f"`window_overlap` has to be a positive multiple of {self.vae_scale_factor_temporal} below "
+                f"`window_frames`, but is {window_overlap}."
+            )
+
+        device = self._execution_device
+        if self.metrics is not None:
+            generation_start = self.metrics.start_timer()
+
+        # 1. Pose latents of the full clip, encoded chunk by chunk in constant memory
+        if pose_latents is None:
+            if height is None or width is None:
+                height, width = self.get_target_size(*self._input_size(smpl), max_resolution)
+            num_frames = self._round_num_frames(min(len(smpl), len(hamer)))
+            encoder = StreamingPoseEncoder(self, height, width, device=device)
+            with self._time_stage("encode", device):
+                for i in range(num_frames):
+                    encoder.push(smpl[i], hamer[i])
+                pose_latents = encoder.finish()
+        num_latent_frames = pose_latents.shape[2]
+        window = min(window, num_latent_frames)
+        window_frames = (window - 1) * self.vae_scale_factor_temporal + 1
+
+        # 2. Shared conditions, and the plan of one window
+        plan = self.plan(
+            height, width, window_frames, num_inference_steps, guidance_scale,
+            ref_size=self.get_ref_size(image, height, width),
+        )
+        state = self.prepare_generation(
+            image=image,
+            prompt=prompt,
+            negative_prompt=negative_prompt,
+            generator=generator,
+            attention_kwargs=attention_kwargs,
+            max_sequence_length=max_sequence_length,
+            pose_latents=pose_latents[:, :, :window],
+            plan=plan,
+        )
+        rotary_emb = self._plan_rotary_emb(plan, state.ref_condition)
+        pose_condition = pose_latents.to(self.transformer.dtype)
+        shape = (1, self.vae.config.z_dim, num_latent_frames, *plan.i2v_condition.shape[3:])
+        latents = randn_tensor(shape, generator=generator, device=device, dtype=torch.float32)
+        windows = [(start, weight.to(device).view(1, 1, -1, 1, 1))
+                   for start, weight in self._window_weights(num_latent_frames, window, overlap)]
+        total_weight = torch.zeros(1, 1, num_latent_frames, 1, 1, device=device)
+        for start, weight in windows:
+            total_weight[:, :, start:start + window] += weight
+
+        # 3. Denoising loop, every step covers all windows
+        self._num_timesteps = len(state.timesteps)
+        with self.progress_bar(total=len(state.timesteps)) as progress_bar:
+            for i, t in enumerate(state.timesteps):
+                self._current_timestep = t
+                if self.metrics is not None:
+                    step_start = self.metrics.start_timer(device)
+                noise_pred = torch.zeros_like(latents)
+                for start, weight in windows:
+                    frames = slice(start, start + window)
+                    window_pred = self._predict_window(
+                        state,
+                        latents[:, :, frames],
+                        state.i2v_condition,
+                        pose_condition[:, :, frames],
+                        t,
+                        rotary_emb,
+                        attention_kwargs,
+                    )
+                    noise_pred[:, :, frames] += window_pred * weight
+                noise_pred = noise_pred / total_weight
+
+                latents = state.scheduler.step(noise_pred, t, latents, return_dict=False)[0]
+                if self.metrics is not None:
+                    self.metrics.stop_timer("step", step_start, device)
+                progress_bar.update()
+
+                if XLA_AVAILABLE:
+                    xm.mark_step()
+
+        self._current_timestep = None
+
+        if output_type == "latent":
+            video = latents
+        else:
+            # one latent frame at a time, see `StreamingVideoDecoder`
+            with self._time_stage("decode", device):
+                video = StreamingVideoDecoder(self, output_type=output_type).push(latents)
+        if self.metrics is not None:
+            self.metrics.stop_timer("generation", generation_start, device)
+        self.maybe_free_model_hooks()
+
+        if not return_dict:
+            return (video,)
+        return WanPipelineOutput(frames=video)
+
+    @torch.no_grad()
+    def generate_stream(
+        self,
+        image: Union[torch.Tensor, np.ndarray],
+        poses: Iterable[Tuple[Union[torch.Tensor, np.ndarray], Union[torch.Tensor, np.ndarray]]],
+        prompt: str = None,
+        negative_prompt: Optional[str] = None,
+        height: Optional[int] = None,
+        width: Optional[int] = None,
+        max_resolution: int = 768 * 768,
+        window_frames: int = 81,
+        context_frames: int = 16,
+        num_inference_steps: int = 40,
+        guidance_scale: float = 2.0,
+        generator: Optional[torch.Generator] = None,
+        output_type: Optional[str] = "np",
+        attention_kwargs: Optional[Dict[str, Any]] = None,
+        max_sequence_length: int = 512,
+    ) -> Iterator[Union[np.ndarray, torch.Tensor]]:
+        r"""
+        Generate a video chunk by chunk and yield every chunk of frames as soon as it is decoded, so the first frames
+        arrive after the cost of one window instead of the whole clip.
+
+        `poses` are frame-aligned (smpl, hamer) uint8 H W C frames, e.g., a `PoseStreamReader` or
+        `zip(smpl, hamer)`; they are encoded with `StreamingPoseEncoder` while they are consumed. The first window
+        of `window_frames` frames is generated as usual. Every later window starts `context_frames` frames before
+        the end of the previous one: at every step, its context latent frames are replaced by the previous clean
+        latents, noised to the current noise level, so the new frames continue the video. Each window yields its new
+        frames only, as F H W C in [0, 1] for "np" (F C H W for "pt"). The last window is moved back to end with the
+        pose, its context is longer then.
+
+        See `generate_long` for the other arguments, TeaCache and step callbacks are not supported.
+        """
+        if not isinstance(prompt, str) or (negative_prompt is not None and not isinstance(negative_prompt, str)):
+            raise ValueError("`prompt` and `negative_prompt` have to be of type `str`, they are shared by all windows.")
+        window_frames = self._round_num_frames(window_frames)
+        window = (window_frames - 1) // self.vae_scale_factor_temporal + 1
+        context = context_frames // self.vae_scale_factor_temporal
+        if context_frames % self.vae_scale_factor_temporal != 0 or not 0 < context < window:
+            raise ValueError(
+                f"`context_frames` has to be a positive multiple of {self.vae_scale_factor_temporal} below "
+                f"`window_frames`, but is {context_frames}."
+            )
+
+        device = self._execution_device
+        poses = iter(poses)
+        first = next(poses, None)
+        if first is None:
+            raise ValueError("No pose frame has been received.")
+        if height is None or width is None:
+            height, width = self.get_target_size(*self._input_size(first[0]), max_resolution)
+        encoder = StreamingPoseEncoder(self, height, width, device=device)
+        encoder.push(*first)
+
+        def encode_until(num_latent_frames):
+            # consume pose frames until `num_latent_frames` latent frames are encoded, False if the poses end before
+            while encoder.num_latent_frames < num_latent_frames:
+                pair = next(poses, None)
+                if pair is None:
+                    return False
+                encoder.push(*pair)
+            return True
+
+        # 1. The first window fixes the shape of all windows, shorter when the poses end early
+        with self._time_stage("encode", device):
+            encode_until(window)
+        window = min(window, encoder.num_latent_frames)
+        plan = self.plan(
+            height, width, (window - 1) * self.vae_scale_factor_temporal + 1, num_inference_steps, guidance_scale,
+            ref_size=self.get_ref_size(image, height, width),
+        )
+        state = self.prepare_generation(
+            image=image,
+            prompt=prompt,
+            negative_prompt=negative_prompt,
+            attention_kwargs=attention_kwargs,
+            max_sequence_length=max_sequence_length,
+            pose_latents=encoder.latents()[:, :, :window],
+            plan=plan,
+        )
+        rotary_emb = self._plan_rotary_emb(plan, state.ref_condition)
+        decoder = StreamingVideoDecoder(self, output_type=output_type)
+        num_train_timesteps = plan.scheduler.config.num_train_timesteps
+        shape = (1, self.vae.config.z_dim, window, *plan.i2v_condition.shape[3:])
+
+        # 2. Window by window: denoise, decode the new latent frames, yield
+        start, num_done, previous, previous_start = 0, 0, None, 0
+        while True:
+            if num_done > 0:
+                with self._time_stage("encode", device):
+                    complete = encode_until(num_done - context + window)
+                if encoder.num_latent_frames <= num_done:
+                    break
+                if not complete:
+                    start = encoder.num_latent_frames - window  # the last window ends with the pose
+            num_context = num_done - start
+            pose_condition = encoder.latents()[:, :, start:start + window].to(self.transformer.dtype)
+            latents = randn_tensor(shape, generator=generator, device=device, dtype=torch.float32)
+            if num_context > 0:
+                context_latents = previous[:, :, start - previous_start:num_done - previous_start]
+                context_noise = randn_tensor(context_latents.shape, generator=generator, device=device,
+                                             dtype=torch.float32)
+
+            scheduler = copy.copy(plan.scheduler)
+            with self.progress_bar(total=len(plan.timesteps)) as progress_bar:
+                for i, t in enumerate(plan.timesteps):
+                    self._current_timestep = t
+                    if self.metrics is not None:
+                        step_start = self.metrics.start_timer(device)
+                    if num_context > 0:
+                        # flow matching: x_t = (1 - sigma) * x0 + sigma * noise, with t = sigma * T
+                        sigma = t / num_train_timesteps
+                        latents[:, :, :num_context] = (1 - sigma) * context_latents + sigma * context_noise
+                    noise_pred = self._predict_window(
+                        state, latents, state.i2v_condition, pose_condition, t, rotary_emb, attention_kwargs
+                    )
+                    latents = scheduler.step(noise_pred, t, latents, return_dict=False)[0]
+                    if self.metrics is not None:
+                        self.metrics.stop_timer("step", step_start, device)
+                    progress_bar.update()
+
+                    if XLA_AVAILABLE:
+                        xm.mark_step()
+            self._current_timestep = None
+
+            with self._time_stage("decode", device):
+                frames = decoder.push(latents[:, :, num_context:])
+            num_done = start + window
+            previous, previous_start = latents, start
+            start = num_done - context
+            yield frames[0]
+
+        decoder.finish()
+        self.maybe_free_model_hooks()
+
+    @torch.no_grad()
+    def prepare_generation(
+        self,
+        image: Union[torch.Tensor, np.ndarray],
+        smpl: Optional[Union[torch.Tensor, np.ndarray]] = None,
+        hamer: Optional[Union[torch.Tensor, np.ndarray]] = None,
+        prompt: Union[str, List[str]] = None,
+        negative_prompt: Union[str, List[str]] = None,
+        height: Optional[int] = None,
+        width: Optional[int] = None,
+        max_resolution: int = 768 * 768,
+        num_frames: int = 81,
+        num_inference_steps: int = 40,
+        guidance_scale: float = 2.0,
+        num_videos_per_prompt: Optional[int] = 1,
+        generator: Optional[Union[torch.Generator, List[torch.Generator]]] = None,
+        latents: Optional[torch.Tensor] = None,
+        prompt_embeds: Optional[torch.Tensor] = None,
+        negative_prompt_embeds: Optional[torch.Tensor] = None,
+        attention_kwargs: Optional[Dict[str, Any]] = None,
+        callback_on_step_end_tensor_inputs: Optional[List[str]] = None,
+        max_sequence_length: int = 512,
+        enable_teacache: bool = False,
+        teacache_thresh: float = 0.2,
+        use_timestep_proj: bool = True,
+        pose_latents: Optional[torch.Tensor] = None,
+        concurrent_conditioning: bool = False,
+        conditioning_memory_budget: Optional[int] = None,
+        scheduler: Optional[FlowMatchEulerDiscreteScheduler] = None,
+        plan: Optional[RealisDanceDiTPlan] = None,
+        tile_size: Optional[int] = None,
+    ) -> "RealisDanceDiTState":
+        r"""
+        Everything of `__call__` before the denoising loop: check inputs, encode the prompt, the reference image and
+        the pose conditions, and prepare the initial latents. See `__call__` for the arguments. `scheduler` defaults
+        to `self.scheduler`; pass a copy to run several generations side by side.
+        """
+        if plan is not None:
+            height, width, num_frames = plan.height, plan.width, plan.num_frames
+            num_inference_steps, guidance_scale = plan.num_inference_steps, plan.guidance_scale
+
+        # 1. Check inputs. Raise error if not correct
+        self.check_inputs(
+            prompt,
+            negative_prompt,
+            image,
+            smpl,
+            hamer,
+            height,
+            width,
+            prompt_embeds,
+            negative_prompt_embeds,
+            callback_on_step_end_tensor_inputs,
+            pose_latents,
+        )
+
+        device = self._execution_device
+
+        # stage inputs on the device, uint8 inputs are normalized there
+        image = self._normalize(self.prepare_input(image, device))
+        if smpl is not None:
+            smpl = self.prepare_input(smpl, device)
+        if hamer is not None:
+            hamer = self.prepare_input(hamer, device)
+
+        if height is None or width is None:
+            height, width = self.get_target_size(*smpl.shape[-2:], max_resolution)
+        num_frames = self._round_num_frames(num_frames)
+
+        self._guidance_scale = guidance_scale
+        self._attention_kwargs = attention_kwargs
+        self._current_timestep = None
+        self._interrupt = False
+
+        # 2. Define call parameters
+        if prompt is not None and isinstance(prompt, str):
+            batch_size = 1
+        elif prompt is not None and isinstance(prompt, list):
+            batch_size = len(prompt)
+        else:
+            batch_size = prompt_embeds.shape[0]
+
+        # 3. Encode input prompt, reference image and pose conditions. T5, CLIP and the VAE encoder are independent,
+        # with `concurrent_conditioning` they run at the same time unless offload hooks or FSDP prevent it
+        executor = ConditioningExecutor(
+            device,
+            concurrent=concurrent_conditioning and supports_concurrent_conditioning(self),
+            memory_budget=conditioning_memory_budget,
+        )
+        executor.submit("prompt", lambda: self.encode_prompt(
+            prompt=prompt,
+            negative_prompt=negative_prompt,
+            do_classifier_free_guidance=self.do_classifier_free_guidance,
+            # a single prompt is encoded once and broadcast to all videos below
+            num_videos_per_prompt=num_videos_per_prompt if batch_size > 1 else 1,
+            prompt_embeds=prompt_embeds,
+            negative_prompt_embeds=negative_prompt_embeds,
+            max_sequence_length=max_sequence_length,
+            device=device,
+        ))
+
+        # Encode image embedding
+        def encode_images():
+            if concurrent_conditioning and self.do_classifier_free_guidance:
+                # the reference and the null image in one CLIP forward
+                return self.encode_image(torch.cat([image, torch.zeros_like(image)]), device).chunk(2)
+            image_embeds = self.encode_image(image, device)
+            null_image_embeds = None
+            if self.do_classifier_free_guidance:
+                null_image_embeds = self.encode_image(torch.zeros_like(image), device)
+            return image_embeds, null_image_embeds
+
+        executor.submit("image", encode_images)
+
+        # 4. Prepare timesteps
+        if scheduler is None and plan is not None:
+            # a fresh copy sharing the precomputed timesteps and sigmas
+            scheduler = copy.copy(plan.scheduler)
+        else:
+            scheduler = scheduler or self.scheduler
+            scheduler.set_timesteps(num_inference_steps, device=device)
+        timesteps = scheduler.timesteps
+
+        # 5. Prepare latent variables
+        num_channels_latents = self.vae.config.z_dim
+        # with tiles, every tile attends to all ref tokens: keep the reference at the area of one tile
+        ref_height, ref_width = height, width
+        if tile_size is not None:
+            ref_height, ref_width = min(height, tile_size), min(width, tile_size)
+        ref_image = self.process_shape(image, ref_height, ref_width, resize_type="max_resolution").to(
+            device, dtype=torch.float32
+        )
+        if pose_latents is None:
+            smpl = self.process_shape(smpl, height, width, resize_type="resize_crop").to(device, dtype=torch.float32)
+            hamer = self.process_shape(hamer, height, width, resize_type="resize_crop").to(device, dtype=torch.float32)
+        # the condition (unless planned), smpl and hamer videos share one VAE encode if it fits the memory budget
+        num_videos = max((1 if plan is None else 0) + (2 if pose_latents is None else 0), 1)
+        batch_vae_encode = concurrent_conditioning and (
+            conditioning_memory_budget is None or
+            estimate_vae_encode_memory(num_videos, height, width) <= conditioning_memory_budget
+        )
+        executor.submit("latents", lambda: self.prepare_latents(
+            ref_image,
+            smpl,
+            hamer,
+            batch_size * num_videos_per_prompt,
+            num_channels_latents,
+            height,
+            width,
+            num_frames,
+            torch.float32,
+            device,
+            generator,
+            latents,
+            pose_latents,
+            batch_vae_encode,
+            plan,
+        ), memory=estimate_vae_encode_memory(num_videos if batch_vae_encode else 1, height, width))
+        with self._time_stage("encode", device):
+            conditions = executor.run()
+
+        transformer_dtype = self.transformer.dtype
+        num_outputs = batch_size * num_videos_per_prompt
+        prompt_embeds, negative_prompt_embeds = conditions["prompt"]
+        prompt_embeds = self._expand_batch(prompt_embeds.to(transformer_dtype), num_outputs)
+        if negative_prompt_embeds is not None:
+            negative_prompt_embeds = self._expand_batch(negative_prompt_embeds.to(transformer_dtype), num_outputs)
+
+        image_embeds, null_image_embeds = conditions["image"]
+        image_embeds = self._expand_batch(image_embeds.to(transformer_dtype), num_outputs)
+        if null_image_embeds is not None:
+            null_image_embeds = self._expand_batch(null_image_embeds.to(transformer_dtype), num_outputs)
+
+        latents, i2v_condition, pose_condition, ref_condition, null_ref_condition = conditions["latents"]
+        pose_condition = pose_condition.to(transformer_dtype)
+        ref_condition = ref_condition.to(transformer_dtype)
+        if null_ref_condition is not None:
+            null_ref_condition = null_ref_condition.to(transformer_dtype)
+
+        # 6. TeaCache settings
+        teacache_kwargs, teacache_kwargs_uncond = self._get_teacache_kwargs(
+            enable_teacache, teacache_thresh, use_timestep_proj, num_inference_steps
+        )
+
+        return RealisDanceDiTState(
+            latents=latents,
+            i2v_condition=i2v_condition,
+            pose_condition=pose_condition,
+            ref_condition=ref_condition,
+            null_ref_condition=null_ref_condition,
+            prompt_embeds=prompt_embeds,
+            negative_prompt_embeds=negative_prompt_embeds,
+            image_embeds=image_embeds,
+            null_image_embeds=null_image_embeds,
+            scheduler=scheduler,
+            timesteps=timesteps,
+            guidance_scale=guidance_scale,
+            enable_teacache=enable_teacache,
+            teacache_kwargs=teacache_kwargs,
+            teacache_kwargs_uncond=teacache_kwargs_uncond,
+        )
+
     @torch.no_grad()
     @replace_example_docstring(EXAMPLE_DOC_STRING)
     def __call__(
         self,
-        image: torch.Tensor,
-        smpl: torch.Tensor,
-        hamer: torch.Tensor,
+        image: Optional[torch.Tensor] = None,
+        smpl: Optional[torch.Tensor] = None,
+        hamer: Optional[torch.Tensor] = None,
         prompt: Union[str, List[str]] = None,
         negative_prompt: Union[str, List[str]] = None,
         height: Optional[int] = None,
@@ -536,20 +1699,34 @@ class RealisDanceDiTPipeline(DiffusionPipeline, WanLoraLoaderMixin):
         enable_teacache: bool = False,
         teacache_thresh: float = 0.2,
         use_timestep_proj: bool = True,
+        pose_latents: Optional[torch.Tensor] = None,
+        concurrent_conditioning: bool = False,
+        conditioning_memory_budget: Optional[int] = None,
+        checkpoint_path: Optional[str] = None,
+        checkpoint_steps: Optional[int] = None,
+        resume_from: Optional[Union[str, RealisDanceDiTState]] = None,
+        plan: Optional[RealisDanceDiTPlan] = None,
+        tile_size: Optional[int] = None,
+        tile_overlap: int = 128,
+        low_res_steps: int = 0,
+        low_res_factor: int = 2,
+        region_skip_interval: int = 1,
+        region_freeze_step: Optional[int] = None,
+        region_dilation: int = 2,
     ):
         r"""
         The call function to the pipeline for generation.
 
         Args:
-            image (`torch.Tensor`):
-                The input image to condition the generation on. Must be a `torch.Tensor`
-                with shape B C 1 H W and range [-1, 1].
-            smpl (`torch.Tensor`):
-                The input smpl video to condition the generation on. Must be a `torch.Tensor`
-                with shape B C 1 H W and range [-1, 1].
-            hamer (`torch.Tensor`):
-                The input hamer video to condition the generation on. Must be a `torch.Tensor`
-                with shape B C 1 H W and range [-1, 1].
+            image (`torch.Tensor` or `np.ndarray`):
+                The input image to condition the generation on. Either a float `torch.Tensor` with shape B C 1 H W
+                and range [-1, 1], or uint8 in H W C or B C 1 H W.
+            smpl (`torch.Tensor` or `np.ndarray`):
+                The input smpl video to condition the generation on. Either a float `torch.Tensor` with shape
+                B C F H W and range [-1, 1], or uint8 in T H W C or B C F H W.
+            hamer (`torch.Tensor` or `np.ndarray`):
+                The input hamer video to condition the generation on. Either a float `torch.Tensor` with shape
+                B C F H W and range [-1, 1], or uint8 in T H W C or B C F H W.
             prompt (`str` or `List[str]`, *optional*):
                 The prompt or prompts to guide the image generation. If not defined, one has to pass `prompt_embeds`.
                 instead.
@@ -573,10 +1750,11 @@ class RealisDanceDiTPipeline(DiffusionPipeline, WanLoraLoaderMixin):
                 1`. Higher guidance scale encourages to generate images that are closely linked to the text `prompt`,
                 usually at the expense of lower image quality.
             num_videos_per_prompt (`int`, *optional*, defaults to 1):
-                The number of images to generate per prompt.
+                The number of videos to generate per prompt, e.g., variants with different seeds. All conditions are
+                encoded once and broadcast, the variants are denoised in one batch.
             generator (`torch.Generator` or `List[torch.Generator]`, *optional*):
                 A [`torch.Generator`](https://pytorch.org/docs/stable/generated/torch.Generator.html) to make
-                generation deterministic.
+                generation deterministic. Pass one generator per video to seed every variant on its own.
             latents (`torch.Tensor`, *optional*):
                 Pre-generated noisy latents sampled from a Gaussian distribution, to be used as inputs for image
                 generation. Can be used to tweak the same generation with different prompts. If not provided, a latents
@@ -603,7 +1781,8 @@ class RealisDanceDiTPipeline(DiffusionPipeline, WanLoraLoaderMixin):
             callback_on_step_end_tensor_inputs (`List`, *optional*):
                 The list of tensor inputs for the `callback_on_step_end` function. The tensors specified in the list
                 will be passed as `callback_kwargs` argument. You will only be able to include variables listed in the
-                `._callback_tensor_inputs` attribute of your pipeline class.
+                `._callback_tensor_inputs` attribute of your pipeline class. "x0_pred" is the clean latents predicted
+                at the step, e.g., for `LatentPreviewer` previews.
             max_sequence_length (`int`, *optional*, defaults to `512`):
                 The maximum sequence length of the prompt.
             enable_teacache (`bool`, *optional*, defaults to False):
@@ -613,6 +1792,54 @@ class RealisDanceDiTPipeline(DiffusionPipeline, WanLoraLoaderMixin):
                 Threshold for teacache. Higher speedup will cause to worse quality.
             use_timestep_proj (`bool`, *optional*, defaults to True):
                 Whether to use timestep_proj or temb.
+            pose_latents (`torch.Tensor`, *optional*):
+                Pre-encoded and normalized pose condition latents, i.e., the smpl and hamer latents concatenated
+                along channels. Replaces `smpl` and `hamer`, `height` and `width` must be given.
+            concurrent_conditioning (`bool`, *optional*, defaults to False):
+                Run the T5, CLIP and VAE encodes before the first step concurrently, and batch the encodes of each
+                encoder. Falls back to one after another with CPU offload hooks or FSDP-sharded encoders.
+            conditioning_memory_budget (`int`, *optional*):
+                Extra activation memory in bytes the concurrent conditioning may use. Unlimited by default.
+            checkpoint_path (`str`, *optional*):
+                Where to save the denoising state. It is saved every `checkpoint_steps` steps, and when the
+                generation is interrupted (`pipe._interrupt = True`, e.g., from a signal handler or a callback). An
+                interrupted generation returns `None` frames instead of skipping the remaining steps.
+            checkpoint_steps (`int`, *optional*):
+                Save the denoising state every `checkpoint_steps` steps.
+            resume_from (`str` or `RealisDanceDiTState`, *optional*):
+                A state saved to `checkpoint_path` to resume from. All conditioning inputs are ignored.
+            plan (`RealisDanceDiTPlan`, *optional*):
+                Precomputed shape-dependent state from `plan`, see `run`. Overrides `height`, `width`, `num_frames`,
+                `num_inference_steps` and `guidance_scale`.
+            tile_size (`int`, *optional*):
+                Denoise in overlapping spatial tiles of at most `tile_size` x `tile_size` pixels, e.g., 768 for 1080p
+                videos. Every tile attends to its own tokens and to the ref tokens only, with the RoPE positions of its
+                place in the video, and the tile predictions are blended every step, so the cost of a step grows
+                linearly with the resolution. The reference image is encoded at the area of one tile. A multiple of
+                16, not supported with TeaCache.
+            tile_overlap (`int`, *optional*, defaults to 128):
+                Pixels shared by neighboring tiles, a multiple of 16.
+            low_res_steps (`int`, *optional*, defaults to 0):
+                Run the first `low_res_steps` steps at `1 / low_res_factor` of the latent height and width, with the
+                i2v, pose and ref conditions downsampled the same way and the RoPE positions of the full resolution.
+                The early high-noise steps only settle the coarse structure: their predicted clean latents are then
+                upsampled, noised again to the noise level of the next step, and the remaining steps run at the full
+                resolution. Not supported with `tile_size` or `checkpoint_path`.
+            low_res_factor (`int`, *optional*, defaults to 2):
+                Downsampling factor of the low-resolution steps, the generation height and width have to be
+                divisible by `16 * low_res_factor`.
+            region_skip_interval (`int`, *optional*, defaults to 1):
+                Region-adaptive steps: the background, i.e., the video tokens outside of the character found from
+                the pose latents (see `pose_foreground_mask`), converges early, so its prediction is only refreshed
+                every `region_skip_interval` steps and reused in between. On the other steps only the character
+                tokens and the ref tokens run through the transformer, so their cost scales with the character.
+                Not supported with TeaCache, `tile_size`, `low_res_steps`, `checkpoint_path` (the cached background
+                prediction is not saved), sequence parallelism, window attention or token merging.
+            region_freeze_step (`int`, *optional*):
+                Stop refreshing the background prediction from this step on, see `region_skip_interval`.
+            region_dilation (`int`, *optional*, defaults to 2):
+                Grow the character region of `region_skip_interval` and `region_freeze_step` by this many tokens in
+                height and width, to cover the motion around the body.
         Examples:
 
         Returns:
@@ -624,172 +1851,235 @@ class RealisDanceDiTPipeline(DiffusionPipeline, WanLoraLoaderMixin):
 
         if isinstance(callback_on_step_end, (PipelineCallback, MultiPipelineCallbacks)):
             callback_on_step_end_tensor_inputs = callback_on_step_end.tensor_inputs
-
-        # 1. Check inputs. Raise error if not correct
-        self.check_inputs(
-            prompt,
-            negative_prompt,
-            image,
-            smpl,
-            hamer,
-            height,
-            width,
-            prompt_embeds,
-            negative_prompt_embeds,
-            callback_on_step_end_tensor_inputs,
-        )
-
-        if height is None or width is None:
-            smpl_height, smpl_width = smpl.shape[-2:]
-            ratio = (max_resolution / (smpl_height * smpl_width)) ** 0.5
-            scale_factor_h = self.vae_scale_factor_spatial * self.transformer.config.patch_size[1]
-            height = round(smpl_height * ratio / scale_factor_h) * scale_factor_h
-            scale_factor_w = self.vae_scale_factor_spatial * self.transformer.config.patch_size[2]
-            width = round(smpl_width * ratio / scale_factor_w) * scale_factor_w
-
-        if num_frames % self.vae_scale_factor_temporal != 1:
-            logger.warning(
-                f"`num_frames - 1` has to be divisible by {self.vae_scale_factor_temporal}. Rounding to the nearest number."
+        if tile_size is not None:
+            if tile_size % 16 != 0 or tile_overlap % 16 != 0 or not 0 < tile_overlap < tile_size:
+                raise ValueError(
+                    f"`tile_size` and `tile_overlap` have to be multiples of 16 with 0 < `tile_overlap` < `tile_size`, "
+                    f"but are {tile_size} and {tile_overlap}."
+                )
+            if enable_teacache:
+                raise ValueError("TeaCache is not supported with `tile_size`.")
+        if low_res_steps > 0 and (tile_size is not None or checkpoint_path is not None or low_res_factor < 2):
+            raise ValueError(
+                "`low_res_steps` needs `low_res_factor` >= 2, and is not supported with `tile_size` or "
+                "`checkpoint_path`."
             )
-            num_frames = num_frames // self.vae_scale_factor_temporal * self.vae_scale_factor_temporal + 1
-        num_frames = max(num_frames, 1)
-
-        self._guidance_scale = guidance_scale
-        self._attention_kwargs = attention_kwargs
-        self._current_timestep = None
-        self._interrupt = False
-
-        device = self._execution_device
-
-        # 2. Define call parameters
-        if prompt is not None and isinstance(prompt, str):
-            batch_size = 1
-        elif prompt is not None and isinstance(prompt, list):
-            batch_size = len(prompt)
+        region_adaptive = region_skip_interval > 1 or region_freeze_step is not None
+        if region_adaptive and (
+            enable_teacache or tile_size is not None or low_res_steps > 0 or checkpoint_path is not None
+        ):
+            raise ValueError(
+                "`region_skip_interval` and `region_freeze_step` are not supported with TeaCache, `tile_size`, "
+                "`low_res_steps` or `checkpoint_path`."
+            )
+        if region_adaptive and (
+            self.transformer.sp_degree > 1 or self.transformer.token_merging is not None or any(
+                isinstance(block.attn1.processor, WindowAttnProcessor) for block in self.transformer.blocks
+            )
+        ):
+            raise ValueError(
+                "`region_skip_interval` and `region_freeze_step` are not supported with sequence parallelism, "
+                "window attention or token merging."
+            )
+        if self.metrics is not None:
+            generation_start = self.metrics.start_timer()
+
+        # 1-6. Check inputs, encode conditions and prepare latents
+        if resume_from is not None:
+            state = resume_from
+            if isinstance(state, str):
+                state = RealisDanceDiTState.load(state, device=self._execution_device)
+            self._guidance_scale = state.guidance_scale
+            self._attention_kwargs = attention_kwargs
+            self._current_timestep = None
+            self._interrupt = False
+            guidance_scale = state.guidance_scale
+            enable_teacache = state.enable_teacache
+            num_inference_steps = len(state.timesteps)
         else:
-            batch_size = prompt_embeds.shape[0]
-
-        # 3. Encode input prompt
-        prompt_embeds, negative_prompt_embeds = self.encode_prompt(
-            prompt=prompt,
-            negative_prompt=negative_prompt,
-            do_classifier_free_guidance=self.do_classifier_free_guidance,
-            num_videos_per_prompt=num_videos_per_prompt,
-            prompt_embeds=prompt_embeds,
-            negative_prompt_embeds=negative_prompt_embeds,
-            max_sequence_length=max_sequence_length,
-            device=device,
-        )
-
-        # Encode image embedding
+            state = self.prepare_generation(
+                image=image,
+                smpl=smpl,
+                hamer=hamer,
+                prompt=prompt,
+                negative_prompt=negative_prompt,
+                height=height,
+                width=width,
+                max_resolution=max_resolution,
+                num_frames=num_frames,
+                num_inference_steps=num_inference_steps,
+                guidance_scale=guidance_scale,
+                num_videos_per_prompt=num_videos_per_prompt,
+                generator=generator,
+                latents=latents,
+                prompt_embeds=prompt_embeds,
+                negative_prompt_embeds=negative_prompt_embeds,
+                attention_kwargs=attention_kwargs,
+                callback_on_step_end_tensor_inputs=callback_on_step_end_tensor_inputs,
+                max_sequence_length=max_sequence_length,
+                enable_teacache=enable_teacache,
+                teacache_thresh=teacache_thresh,
+                use_timestep_proj=use_timestep_proj,
+                pose_latents=pose_latents,
+                concurrent_conditioning=concurrent_conditioning,
+                conditioning_memory_budget=conditioning_memory_budget,
+                plan=plan,
+                tile_size=tile_size,
+            )
+        latents = state.latents
+        i2v_condition = state.i2v_condition
+        pose_condition = state.pose_condition
+        ref_condition = state.ref_condition
+        null_ref_condition = state.null_ref_condition
+        prompt_embeds = state.prompt_embeds
+        negative_prompt_embeds = state.negative_prompt_embeds
+        image_embeds = state.image_embeds
+        null_image_embeds = state.null_image_embeds
+        timesteps = state.timesteps
+        teacache_kwargs = state.teacache_kwargs
+        teacache_kwargs_uncond = state.teacache_kwargs_uncond
         transformer_dtype = self.transformer.dtype
-        prompt_embeds = prompt_embeds.to(transformer_dtype)
-        if negative_prompt_embeds is not None:
-            negative_prompt_embeds = negative_prompt_embeds.to(transformer_dtype)
-
-        image_embeds = self.encode_image(image, device)
-        image_embeds = image_embeds.repeat(batch_size, 1, 1)
-        image_embeds = image_embeds.to(transformer_dtype)
-        if self.do_classifier_free_guidance:
-            null_image_embeds = self.encode_image(torch.zeros_like(image), device)
-            null_image_embeds = null_image_embeds.repeat(batch_size, 1, 1)
-            null_image_embeds = null_image_embeds.to(transformer_dtype)
-        else:
-            null_image_embeds = None
-
-        # 4. Prepare timesteps
-        self.scheduler.set_timesteps(num_inference_steps, device=device)
-        timesteps = self.scheduler.timesteps
-
-        # 5. Prepare latent variables
-        num_channels_latents = self.vae.config.z_dim
-        image = self.process_shape(image, height, width, resize_type="max_resolution").to(device, dtype=torch.float32)
-        smpl = self.process_shape(smpl, height, width, resize_type="resize_crop").to(device, dtype=torch.float32)
-        hamer = self.process_shape(hamer, height, width, resize_type="resize_crop").to(device, dtype=torch.float32)
-        latents, i2v_condition, pose_condition, ref_condition, null_ref_condition = self.prepare_latents(
-            image,
-            smpl,
-            hamer,
-            batch_size * num_videos_per_prompt,
-            num_channels_latents,
-            height,
-            width,
-            num_frames,
-            torch.float32,
-            device,
-            generator,
-            latents,
-        )
-        pose_condition = pose_condition.to(transformer_dtype)
-        ref_condition = ref_condition.to(transformer_dtype)
-        null_ref_condition = null_ref_condition.to(transformer_dtype)
+        # tiles prepare their own RoPE
+        rotary_emb = self._plan_rotary_emb(plan, ref_condition) if tile_size is None else None
+        if tile_size is not None:
+            tiles, tile_weight = self._prepare_tiles(latents, ref_condition, tile_size, tile_overlap)
+        if low_res_steps > 0:
+            p_h, p_w = self.transformer.config.patch_size[1:]
+            full_shape = latents.shape
+            if state.step > 0 or low_res_steps >= len(timesteps):
+                raise ValueError("`low_res_steps` has to be below the number of steps, and cannot resume a state.")
+            if full_shape[3] % (low_res_factor * p_h) != 0 or full_shape[4] % (low_res_factor * p_w) != 0:
+                raise ValueError(
+                    f"`height` and `width` have to be divisible by {16 * low_res_factor} for `low_res_steps`."
+                )
+            full_conditions = (i2v_condition, pose_condition, ref_condition, null_ref_condition, rotary_emb)
+            # every `low_res_factor`-th noise sample keeps unit variance, unlike the mean
+            latents = latents[..., ::low_res_factor, ::low_res_factor]
+            i2v_condition, pose_condition, ref_condition, null_ref_condition = (
+                self._downsample_latents(x, low_res_factor)
+                for x in (i2v_condition, pose_condition, ref_condition, null_ref_condition)
+            )
+            rotary_emb = self.transformer.prepare_rotary_emb(
+                latents[:, :0], ref_condition[:, :0], canvas_size=full_shape[3:], stride=low_res_factor
+            )
 
-        # 6. TeaCache settings
-        if enable_teacache:
-            teacache_kwargs = {
-                "teacache_thresh": teacache_thresh,
-                "accumulated_rel_l1_distance": 0,
-                "previous_e0": None,
-                "previous_residual": None,
-                "use_timestep_proj": use_timestep_proj,
-                "coefficients": [
-                    8.10705460e+03, 2.13393892e+03, -3.72934672e+02, 1.66203073e+01, -4.17769401e-02
-                ] if use_timestep_proj else[
-                    -114.36346466, 65.26524496, -18.82220707, 4.91518089, -0.23412683
-                ],
-                "ret_steps": 5 if use_timestep_proj else 1,
-                "cutoff_steps": num_inference_steps
-            }
-            if self.do_classifier_free_guidance:
-                teacache_kwargs_uncond = copy.deepcopy(teacache_kwargs)
-        else:
-            teacache_kwargs = teacache_kwargs_uncond = None
+        if region_adaptive:
+            if region_skip_interval < 1:
+                raise ValueError(f"`region_skip_interval` has to be at least 1, but is {region_skip_interval}.")
+            if state.enable_teacache:
+                raise ValueError("`region_skip_interval` and `region_freeze_step` are not supported with TeaCache.")
+            active_tokens, region_mask = self._region_mask(pose_condition, region_dilation)
+            cached_noise_pred = None
+
+        def _save_checkpoint(step):
+            state.latents = latents
+            state.prompt_embeds = prompt_embeds
+            state.negative_prompt_embeds = negative_prompt_embeds
+            state.teacache_kwargs = teacache_kwargs
+            state.teacache_kwargs_uncond = teacache_kwargs_uncond
+            state.step = step
+            state.save(checkpoint_path)
 
         # 7. Denoising loop
-        num_warmup_steps = len(timesteps) - num_inference_steps * self.scheduler.order
+        num_warmup_steps = len(timesteps) - num_inference_steps * state.scheduler.order
         self._num_timesteps = len(timesteps)
+        start_step = state.step
+        preempted = False
 
         with self.progress_bar(total=num_inference_steps) as progress_bar:
+            progress_bar.update(start_step)
             for i, t in enumerate(timesteps):
+                if i < start_step:  # already done before the checkpoint
+                    continue
                 if self.interrupt:
+                    if checkpoint_path is not None and not preempted:
+                        _save_checkpoint(i)
+                        preempted = True
                     continue
 
                 self._current_timestep = t
-                latent_model_input = torch.cat([latents, i2v_condition], dim=1).to(transformer_dtype)
-                timestep = t.expand(latents.shape[0])
-
-                noise_pred, teacache_kwargs = self.transformer(
-                    hidden_states=latent_model_input,
-                    timestep=timestep,
-                    encoder_hidden_states=prompt_embeds,
-                    encoder_hidden_states_image=image_embeds,
-                    attention_kwargs=attention_kwargs,
-                    return_dict=False,
-                    add_cond=pose_condition,
-                    attn_cond=ref_condition,
-                    enable_teacache=enable_teacache,
-                    current_step=i,
-                    teacache_kwargs=teacache_kwargs,
-                )
+                if self.metrics is not None:
+                    step_start = self.metrics.start_timer(latents.device)
+                if tile_size is not None:
+                    # the tiles read the conditions from the state, keep callback updates
+                    state.prompt_embeds = prompt_embeds
+                    state.negative_prompt_embeds = negative_prompt_embeds
+                    noise_pred = self._predict_tiled(state, latents, t, tiles, tile_weight, attention_kwargs)
+                else:
+                    latent_model_input = torch.cat([latents, i2v_condition], dim=1).to(transformer_dtype)
+                    timestep = t.expand(latents.shape[0])
+                    # region-adaptive: refresh the background every `region_skip_interval` steps until freezing
+                    skip_background = region_adaptive and cached_noise_pred is not None and not (
+                        (region_freeze_step is None or i < region_freeze_step)
+                        and (i - start_step) % region_skip_interval == 0
+                    )
 
-                if self.do_classifier_free_guidance:
-                    noise_uncond, teacache_kwargs_uncond = self.transformer(
+                    noise_pred, teacache_kwargs = self.transformer(
                         hidden_states=latent_model_input,
                         timestep=timestep,
-                        encoder_hidden_states=negative_prompt_embeds,
-                        encoder_hidden_states_image=null_image_embeds,
+                        encoder_hidden_states=prompt_embeds,
+                        encoder_hidden_states_image=image_embeds,
                         attention_kwargs=attention_kwargs,
                         return_dict=False,
                         add_cond=pose_condition,
-                        attn_cond=null_ref_condition,
+                        attn_cond=ref_condition,
                         enable_teacache=enable_teacache,
                         current_step=i,
-                        teacache_kwargs=teacache_kwargs_uncond,
+                        teacache_kwargs=teacache_kwargs,
+                        rotary_emb=rotary_emb,
+                        active_tokens=active_tokens if skip_background else None,
                     )
-                    noise_pred = noise_uncond + guidance_scale * (noise_pred - noise_uncond)
+
+                    if self.do_classifier_free_guidance:
+                        noise_uncond, teacache_kwargs_uncond = self.transformer(
+                            hidden_states=latent_model_input,
+                            timestep=timestep,
+                            encoder_hidden_states=negative_prompt_embeds,
+                            encoder_hidden_states_image=null_image_embeds,
+                            attention_kwargs=attention_kwargs,
+                            return_dict=False,
+                            add_cond=pose_condition,
+                            attn_cond=null_ref_condition,
+                            enable_teacache=enable_teacache,
+                            current_step=i,
+                            teacache_kwargs=teacache_kwargs_uncond,
+                            rotary_emb=rotary_emb,
+                            active_tokens=active_tokens if skip_background else None,
+                        )
+                        noise_pred = noise_uncond + guidance_scale * (noise_pred - noise_uncond)
+
+                    if region_adaptive:
+                        if skip_background:
+                            noise_pred = torch.where(region_mask, noise_pred, cached_noise_pred)
+                        cached_noise_pred = noise_pred
+
+                if callback_on_step_end is not None and "x0_pred" in callback_on_step_end_tensor_inputs:
+                    # flow matching: x_t = (1 - sigma) * x0 + sigma * noise and v = noise - x0, with t = sigma * T
+                    x0_pred = latents - t / state.scheduler.config.num_train_timesteps * noise_pred
+
+                if i == low_res_steps - 1:
+                    low_res_x0 = latents - t / state.scheduler.config.num_train_timesteps * noise_pred
 
                 # compute the previous noisy sample x_t -> x_t-1
-                latents = self.scheduler.step(noise_pred, t, latents, return_dict=False)[0]
+                latents = state.scheduler.step(noise_pred, t, latents, return_dict=False)[0]
+
+                if i == low_res_steps - 1:
+                    # back to full resolution: upsample the predicted x0 and re-inject noise of the next noise level
+                    sigma_next = timesteps[i + 1] / state.scheduler.config.num_train_timesteps
+                    noise = randn_tensor(full_shape, generator=generator, device=latents.device, dtype=latents.dtype)
+                    low_res_x0 = F.interpolate(low_res_x0, size=full_shape[2:], mode="trilinear", align_corners=False)
+                    latents = (1 - sigma_next) * low_res_x0 + sigma_next * noise
+                    i2v_condition, pose_condition, ref_condition, null_ref_condition, rotary_emb = full_conditions
+                    for kwargs in (teacache_kwargs, teacache_kwargs_uncond):
+                        if kwargs is not None:  # the cached residual is of the low resolution
+                            kwargs["previous_residual"] = None
+
+                if self.metrics is not None:
+                    self.metrics.stop_timer("step", step_start, latents.device)
+                    if enable_teacache:
+                        self.metrics.inc_teacache(not teacache_kwargs["should_calc"])
+                        if self.do_classifier_free_guidance:
+                            self.metrics.inc_teacache(not teacache_kwargs_uncond["should_calc"])
 
                 if callback_on_step_end is not None:
                     callback_kwargs = {}
@@ -802,31 +2092,26 @@ class RealisDanceDiTPipeline(DiffusionPipeline, WanLoraLoaderMixin):
                     negative_prompt_embeds = callback_outputs.pop("negative_prompt_embeds", negative_prompt_embeds)
 
                 # call the callback, if provided
-                if i == len(timesteps) - 1 or ((i + 1) > num_warmup_steps and (i + 1) % self.scheduler.order == 0):
+                if i == len(timesteps) - 1 or ((i + 1) > num_warmup_steps and (i + 1) % state.scheduler.order == 0):
                     progress_bar.update()
 
+                if checkpoint_path is not None and checkpoint_steps and (i + 1) % checkpoint_steps == 0:
+                    _save_checkpoint(i + 1)
+
                 if XLA_AVAILABLE:
                     xm.mark_step()
 
         self._current_timestep = None
 
-        if not output_type == "latent":
-            latents = latents.to(self.vae.dtype)
-            latents_mean = (
-                torch.tensor(self.vae.config.latents_mean)
-                .view(1, self.vae.config.z_dim, 1, 1, 1)
-                .to(latents.device, latents.dtype)
-            )
-            latents_std = (
-                1.0 / torch.tensor(self.vae.config.latents_std)
-                .view(1, self.vae.config.z_dim, 1, 1, 1)
-                .to(latents.device, latents.dtype)
-            )
-            latents = latents / latents_std + latents_mean
-            video = self.vae.decode(latents, return_dict=False)[0]
-            video = self.video_processor.postprocess_video(video, output_type=output_type)
-        else:
-            video = latents
+        if preempted:
+            self.maybe_free_model_hooks()
+            if not return_dict:
+                return (None,)
+            return WanPipelineOutput(frames=None)
+
+        video = self.decode_latents(latents, output_type=output_type, plan=plan)
+        if self.metrics is not None:
+            self.metrics.stop_timer("generation", generation_start, latents.device)
 
         # Offload all models
         self.maybe_free_model_hooks()
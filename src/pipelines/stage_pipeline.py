@@ -0,0 +1,153 @@
+# Copyright 2025 The RealisDance-DiT Team. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+import copy
+import queue
+import threading
+import traceback
+
+from concurrent.futures import Future
+
+import torch
+
+from diffusers.utils import logging
+
+logger = logging.get_logger(__name__)  # pylint: disable=invalid-name
+
+
+class _Request:
+    def __init__(self, kwargs, output_type):
+        self.kwargs = kwargs
+        self.output_type = output_type
+        self.future = Future()
+        self.state = None
+        self.latents = None
+
+
+class StagePipeline:
+    r"""
+    Multi-request stage pipeline for `RealisDanceDiTPipeline`.
+
+    The three stages of a generation run in their own worker thread, each bound to its own device:
+        - encode: T5, CLIP and the VAE encoder (`prepare_generation`), on `encode_device` (may be "cpu").
+        - denoise: the transformer, on `denoise_device`.
+        - decode: the VAE decoder, on `decode_device`.
+    Stages hand over `RealisDanceDiTState`s and latents through bounded queues, so while request N is denoised,
+    request N+1 is encoded and request N-1 is decoded, and steady-state throughput approaches the DiT-bound limit.
+    `max_queue_size` bounds how many prepared states / latents wait between stages, i.e., the extra memory.
+
+    The pipeline must not use offload hooks, modules are moved to their stage devices here. The VAE is copied when
+    `encode_device` and `decode_device` differ.
+
+    Usage:
+        stages = StagePipeline(pipe, encode_device="cuda:0", denoise_device="cuda:1", decode_device="cuda:0")
+        stages.start()
+        video = stages.submit(image=..., smpl=..., hamer=..., prompt=...).result()
+    """
+
+    def __init__(self, pipe, encode_device, denoise_device, decode_device, max_queue_size=2):
+        encode_device, denoise_device, decode_device = (
+            torch.device(d) for d in (encode_device, denoise_device, decode_device)
+        )
+        self.pipe = pipe
+        self.denoise_device = denoise_device
+        self.decode_device = decode_device
+
+        pipe.text_encoder.to(encode_device)
+        pipe.image_encoder.to(encode_device)
+        pipe.transformer.to(denoise_device)
+        encode_vae = pipe.vae.to(encode_device)
+        decode_vae = encode_vae if decode_device == encode_device else copy.deepcopy(encode_vae).to(decode_device)
+        # pipelines sharing the modules, with the VAE of their stage
+        self.encode_pipe = type(pipe)(**{**pipe.components, "vae": encode_vae})
+        self.decode_pipe = type(pipe)(**{**pipe.components, "vae": decode_vae})
+        self.encode_pipe.metrics = self.decode_pipe.metrics = pipe.metrics
+
+        self._inputs = queue.Queue(maxsize=max_queue_size)
+        self._encoded = queue.Queue(maxsize=max_queue_size)
+        self._denoised = queue.Queue(maxsize=max_queue_size)
+        self._threads = [
+            threading.Thread(target=self._encode_loop, daemon=True),
+            threading.Thread(target=self._denoise_loop, daemon=True),
+            threading.Thread(target=self._decode_loop, daemon=True),
+        ]
+
+    def start(self):
+        for thread in self._threads:
+            thread.start()
+        return self
+
+    def submit(self, output_type="np", **kwargs):
+        """
+        Queue a generation with the same keyword arguments as `RealisDanceDiTPipeline.__call__`. Blocks while the
+        encode stage is `max_queue_size` requests behind. Returns a `Future` of the decoded frames.
+        """
+        request = _Request(kwargs, output_type)
+        self._inputs.put(request)
+        return request.future
+
+    def stop(self):
+        """
+        Finish the queued requests and stop the workers.
+        """
+        self._inputs.put(None)
+        for thread in self._threads:
+            thread.join()
+
+    @staticmethod
+    def _run_stage(name, src, dst, fn):
+        while True:
+            request = src.get()
+            if request is None:
+                if dst is not None:
+                    dst.put(None)
+                return
+            try:
+                fn(request)
+            except Exception as e:
+                logger.warning(f"The {name} stage failed:\n{traceback.format_exc()}")
+                request.future.set_exception(e)
+                continue
+            if dst is not None:
+                dst.put(request)
+
+    @torch.no_grad()
+    def _encode(self, request):
+        # every generation steps its own copy of the scheduler
+        state = self.encode_pipe.prepare_generation(scheduler=copy.deepcopy(self.pipe.scheduler), **request.kwargs)
+        request.state = state.to(self.denoise_device)
+
+    @torch.no_grad()
+    def _denoise(self, request):
+        latents = self.pipe(
+            resume_from=request.state,
+            attention_kwargs=request.kwargs.get("attention_kwargs"),
+            output_type="latent",
+            return_dict=False,
+        )[0]
+        request.state = None
+        request.latents = latents.to(self.decode_device)
+
+    @torch.no_grad()
+    def _decode(self, request):
+        request.future.set_result(self.decode_pipe.decode_latents(request.latents, request.output_type))
+        request.latents = None
+
+    def _encode_loop(self):
+        self._run_stage("encode", self._inputs, self._encoded, self._encode)
+
+    def _denoise_loop(self):
+        self._run_stage("denoise", self._encoded, self._denoised, self._denoise)
+
+    def _decode_loop(self):
+        self._run_stage("decode", self._denoised, None, self._decode)
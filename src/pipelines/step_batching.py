@@ -0,0 +1,192 @@
+# Copyright 2025 The RealisDance-DiT Team. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+import copy
+import queue
+import threading
+import traceback
+
+from concurrent.futures import Future
+
+import torch
+
+from diffusers.utils import logging
+
+logger = logging.get_logger(__name__)  # pylint: disable=invalid-name
+
+
+class _Request:
+    def __init__(self, kwargs, output_type):
+        self.kwargs = kwargs
+        self.output_type = output_type
+        self.future = Future()
+        self.state = None
+
+
+class StepBatcher:
+    r"""
+    Iteration-level scheduler for `RealisDanceDiTPipeline`.
+
+    Every iteration runs one denoising step for up to `max_batch_size` in-flight generations of compatible shape in
+    a single `RealisDanceDiT.forward`. Each generation keeps its own scheduler and is at its own timestep; the
+    transformer already embeds the timestep per sample. The conditional and unconditional (CFG) branches of all
+    generations go into the same batch. New generations are prepared and join at step boundaries, finished ones are
+    decoded and leave without waiting for the others.
+
+    TeaCache decides per forward whether to skip all blocks, which does not hold for a batch of generations at
+    different timesteps, and one forward cannot apply per-generation attention options, so `enable_teacache` and
+    `attention_kwargs` are not supported: `submit` drops them with a warning. With a timestep-dependent token
+    merging ratio only generations at the same timestep share a forward.
+
+    Usage:
+        batcher = StepBatcher(pipe, max_batch_size=4)
+        threading.Thread(target=batcher.run_forever, daemon=True).start()
+        video = batcher.submit(image=..., smpl=..., hamer=..., prompt=...).result()
+    """
+
+    def __init__(self, pipe, max_batch_size=4):
+        self.pipe = pipe
+        self.max_batch_size = max_batch_size
+        self._pending = queue.Queue()
+        self._active = []
+        self._stop = threading.Event()
+
+    def submit(self, output_type="np", **kwargs):
+        """
+        Queue a generation with the same keyword arguments as `RealisDanceDiTPipeline.__call__`.
+        Returns a `Future` of the decoded frames.
+        """
+        unsupported = [name for name in ("enable_teacache", "attention_kwargs") if kwargs.pop(name, None)]
+        if unsupported:
+            logger.warning(f"Step-level batching does not support {unsupported}, the generation runs without them.")
+        request = _Request(kwargs, output_type)
+        self._pending.put(request)
+        return request.future
+
+    def stop(self):
+        self._stop.set()
+
+    def _shape_key(self, state):
+        # generations can share a forward when every per-sample tensor has the same shape
+        key = (
+            tuple(state.latents.shape[1:]),
+            tuple(state.ref_condition.shape[1:]),
+            tuple(state.prompt_embeds.shape[1:]),
+            tuple(state.image_embeds.shape[1:]),
+        )
+        token_merging = self.pipe.transformer.token_merging
+        if token_merging is not None and callable(token_merging["ratio"]):
+            # a timestep-dependent merge ratio is shared by the whole batch, so only equal timesteps can group
+            key += (float(state.timesteps[state.step]),)
+        return key
+
+    def _admit(self, block):
+        while True:
+            try:
+                request = self._pending.get(block=block and not self._active, timeout=1.0)
+            except queue.Empty:
+                return
+            try:
+                # every generation steps its own copy of the scheduler
+                request.state = self.pipe.prepare_generation(
+                    scheduler=copy.deepcopy(self.pipe.scheduler), **request.kwargs
+                )
+                self._active.append(request)
+            except Exception as e:
+                logger.warning(f"Failed to prepare a generation:\n{traceback.format_exc()}")
+                request.future.set_exception(e)
+            block = False
+
+    def _select(self):
+        # the group of the generation that waited longest goes first
+        key = self._shape_key(self._active[0].state)
+        return [r for r in self._active if self._shape_key(r.state) == key][:self.max_batch_size]
+
+    @torch.no_grad()
+    def step(self):
+        """
+        Run one denoising step for the next batch of compatible generations.
+        """
+        requests = self._select()
+        transformer_dtype = self.pipe.transformer.dtype
+        metrics = self.pipe.metrics
+        if metrics is not None:
+            step_start = metrics.start_timer(requests[0].state.latents.device)
+
+        hidden_states, timestep, prompt_embeds, image_embeds, add_cond, attn_cond, sizes = [], [], [], [], [], [], []
+        for request in requests:
+            state = request.state
+            latent_model_input = torch.cat([state.latents, state.i2v_condition], dim=1).to(transformer_dtype)
+            t = state.timesteps[state.step].expand(state.latents.shape[0])
+            branches = [(state.prompt_embeds, state.image_embeds, state.ref_condition)]
+            if state.do_classifier_free_guidance:
+                branches.append((state.negative_prompt_embeds, state.null_image_embeds, state.null_ref_condition))
+            for branch_prompt_embeds, branch_image_embeds, branch_ref in branches:
+                hidden_states.append(latent_model_input)
+                timestep.append(t)
+                prompt_embeds.append(branch_prompt_embeds)
+                image_embeds.append(branch_image_embeds)
+                add_cond.append(state.pose_condition)
+                attn_cond.append(branch_ref)
+            sizes.append(state.latents.shape[0])
+
+        noise_pred = self.pipe.transformer(
+            hidden_states=torch.cat(hidden_states),
+            timestep=torch.cat(timestep),
+            encoder_hidden_states=torch.cat(prompt_embeds),
+            encoder_hidden_states_image=torch.cat(image_embeds),
+            return_dict=False,
+            add_cond=torch.cat(add_cond),
+            attn_cond=torch.cat(attn_cond),
+        )[0]
+
+        offset = 0
+        for request, size in zip(requests, sizes):
+            state = request.state
+            noise_cond = noise_pred[offset:offset + size]
+            offset += size
+            if state.do_classifier_free_guidance:
+                noise_uncond = noise_pred[offset:offset + size]
+                offset += size
+                noise_cond = noise_uncond + state.guidance_scale * (noise_cond - noise_uncond)
+            t = state.timesteps[state.step]
+            state.latents = state.scheduler.step(noise_cond, t, state.latents, return_dict=False)[0]
+            state.step += 1
+        if metrics is not None:
+            metrics.stop_timer("step", step_start, requests[0].state.latents.device)
+
+        # round robin, so that every shape group and every generation gets its turn
+        self._active = [r for r in self._active if r not in requests] + requests
+
+    def _retire(self):
+        for request in [r for r in self._active if r.state.done]:
+            self._active.remove(request)
+            try:
+                request.future.set_result(self.pipe.decode_latents(request.state.latents, request.output_type))
+            except Exception as e:
+                request.future.set_exception(e)
+
+    def run_forever(self):
+        while not self._stop.is_set():
+            self._admit(block=True)
+            if not self._active:
+                continue
+            try:
+                self.step()
+            except Exception as e:
+                # fail the whole batch, the others keep running
+                logger.warning(f"Denoising step failed:\n{traceback.format_exc()}")
+                for request in self._select():
+                    self._active.remove(request)
+                    request.future.set_exception(e)
+            self._retire()
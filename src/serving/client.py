@@ -0,0 +1,129 @@
+# Copyright 2025 The RealisDance-DiT Team. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+"""
+Minimal client for the local inference server, usable as a library or from the command line:
+
+    python -m src.serving.client --address 127.0.0.1:8000 \\
+        --ref __assets__/demo/ref.png --smpl __assets__/demo/smpl.mp4 --hamer __assets__/demo/hamer.mp4 \\
+        --prompt "..." --output ./output/demo.mp4
+"""
+import argparse
+import http.client
+import json
+import socket
+import time
+
+
+class _UnixHTTPConnection(http.client.HTTPConnection):
+    def __init__(self, path, timeout=None):
+        super().__init__("localhost", timeout=timeout)
+        self.unix_path = path
+
+    def connect(self):
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.sock.settimeout(self.timeout)
+        self.sock.connect(self.unix_path)
+
+
+class RealisDanceClient:
+    def __init__(self, address, timeout=60):
+        self.address = address
+        self.timeout = timeout
+
+    def _connect(self):
+        if self.address.startswith("unix:"):
+            return _UnixHTTPConnection(self.address[len("unix:"):], timeout=self.timeout)
+        host, port = self.address.rsplit(":", 1)
+        return http.client.HTTPConnection(host, int(port), timeout=self.timeout)
+
+    def _request(self, method, path, payload=None):
+        conn = self._connect()
+        try:
+            body = json.dumps(payload).encode("utf-8") if payload is not None else None
+            headers = {"Content-Type": "application/json"} if body is not None else {}
+            conn.request(method, path, body=body, headers=headers)
+            response = conn.getresponse()
+            data = response.read()
+        finally:
+            conn.close()
+        if response.getheader("Content-Type") == "application/json":
+            data = json.loads(data.decode("utf-8"))
+        if response.status != 200:
+            raise RuntimeError(f"{method} {path} failed with {response.status}: {data}")
+        return data
+
+    def submit(self, **params):
+        return self._request("POST", "/jobs", params)["id"]
+
+    def status(self, job_id):
+        return self._request("GET", f"/jobs/{job_id}")
+
+    def result(self, job_id):
+        return self._request("GET", f"/jobs/{job_id}/result")
+
+    def health(self):
+        return self._request("GET", "/health")
+
+    def wait(self, job_id, poll_interval=2.0):
+        while True:
+            status = self.status(job_id)
+            if status["status"] in ("done", "failed"):
+                return status
+            time.sleep(poll_interval)
+
+
+def main():
+    # argparse
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--address', type=str, default="127.0.0.1:8000", help='Server address.')
+    parser.add_argument('--ref', type=str, required=True, help='path to reference image.')
+    parser.add_argument('--smpl', type=str, default=None, help='Path to smpl video.')
+    parser.add_argument('--hamer', type=str, default=None, help='Path to hamer video.')
+    parser.add_argument('--pose-bundle', type=str, default=None, help='Path to pose bundle.')
+    parser.add_argument('--prompt', type=str, required=True, help='Prompt for video.')
+    parser.add_argument('--max-res', type=int, default=768 * 768, help='Resolution of the generated video.')
+    parser.add_argument('--num-frames', type=int, default=81, help='Number of the generated video frames.')
+    parser.add_argument('--seed', type=int, default=1024, help='The generation seed.')
+    parser.add_argument('--enable-teacache', action='store_true', help='Enable teacache.')
+    parser.add_argument('--deadline', type=float, default=None, help='Seconds from now the job should finish in.')
+    parser.add_argument('--output', type=str, default=None, help='Where to save the generated video.')
+    args = parser.parse_args()
+
+    client = RealisDanceClient(args.address)
+    job_id = client.submit(
+        ref=args.ref,
+        smpl=args.smpl,
+        hamer=args.hamer,
+        pose_bundle=args.pose_bundle,
+        prompt=args.prompt,
+        max_res=args.max_res,
+        num_frames=args.num_frames,
+        seed=args.seed,
+        enable_teacache=args.enable_teacache,
+        deadline=time.time() + args.deadline if args.deadline is not None else None,
+    )
+    print(f"Submitted job {job_id}")
+    status = client.wait(job_id)
+    if status["status"] == "failed":
+        raise RuntimeError(f"Job {job_id} failed:\n{status['error']}")
+    if args.output is not None:
+        with open(args.output, "wb") as f:
+            f.write(client.result(job_id))
+        print(f"Saved to {args.output}")
+    else:
+        print(f"Done, saved on the server to {status['result']}")
+
+
+if __name__ == "__main__":
+    main()
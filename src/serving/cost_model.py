@@ -0,0 +1,201 @@
+# Copyright 2025 The RealisDance-DiT Team. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+"""
+Latency and memory cost model of RealisDance-DiT generations.
+
+One transformer forward over `L` self-attention tokens (video + ref tokens, as built in `RealisDanceDiT.forward`)
+is modeled as `c0 + c1 * L + c2 * L ** 2`: projections and FFN are linear in `L`, attention is quadratic. VAE
+encode / decode are linear in the number of pixels, peak memory is linear in `L` on top of the weights. All
+coefficients are fitted by `calibrate`, which benchmarks the loaded pipeline on the current device.
+"""
+import json
+import time
+
+import numpy as np
+import torch
+
+# expected fraction of skipped forwards with TeaCache at the default threshold
+DEFAULT_TEACACHE_SKIP_RATIO = 0.4
+
+
+def get_request_shape(height, width, num_frames, vae_scale_factor_temporal=4, vae_scale_factor_spatial=8,
+                      patch_size=(1, 2, 2)):
+    """
+    Number of self-attention tokens and pixels of a generation.
+    """
+    num_latent_frames = (num_frames - 1) // vae_scale_factor_temporal + 1
+    tokens_per_frame = (height // vae_scale_factor_spatial // patch_size[1]) * (
+        width // vae_scale_factor_spatial // patch_size[2])
+    num_video_tokens = num_latent_frames // patch_size[0] * tokens_per_frame
+    num_ref_tokens = tokens_per_frame  # the ref image is resized to the same area
+    return {
+        "num_tokens": num_video_tokens + num_ref_tokens,
+        "num_pixels": num_frames * height * width,
+    }
+
+
+class CostModel:
+    """
+    Predict per-stage latency (seconds) and peak memory (bytes) of a generation.
+    """
+
+    def __init__(self, coefficients=None, device_name=None):
+        self.coefficients = coefficients or {}
+        self.device_name = device_name
+
+    @property
+    def calibrated(self):
+        return bool(self.coefficients)
+
+    def predict(self, height, width, num_frames=81, num_inference_steps=40, guidance_scale=2.0,
+                enable_teacache=False, teacache_skip_ratio=DEFAULT_TEACACHE_SKIP_RATIO):
+        if not self.calibrated:
+            raise RuntimeError("The cost model is not calibrated, run `calibrate` or `CostModel.load` first.")
+        c = self.coefficients
+        shape = get_request_shape(height, width, num_frames)
+        num_tokens, num_pixels = shape["num_tokens"], shape["num_pixels"]
+
+        num_forwards = num_inference_steps * (2 if guidance_scale > 1 else 1)
+        if enable_teacache:
+            num_forwards *= 1 - teacache_skip_ratio
+        step = c["dit"][0] + c["dit"][1] * num_tokens + c["dit"][2] * num_tokens ** 2
+        # smpl, hamer and the i2v condition are full-length videos, the ref image is negligible next to them
+        encode = c["text"] + c["encode"][0] + c["encode"][1] * num_pixels * 3
+        decode = c["decode"][0] + c["decode"][1] * num_pixels
+        return {
+            "num_tokens": num_tokens,
+            "encode": encode,
+            "denoise": step * num_forwards,
+            "decode": decode,
+            "total": encode + step * num_forwards + decode,
+            "memory": c["memory"][0] + c["memory"][1] * num_tokens,
+        }
+
+    def save(self, path):
+        with open(path, "w", encoding="utf-8") as f:
+            json.dump({"device_name": self.device_name, "coefficients": self.coefficients}, f, indent=2)
+
+    @classmethod
+    def load(cls, path):
+        with open(path, "r", encoding="utf-8") as f:
+            data = json.load(f)
+        return cls(data["coefficients"], data.get("device_name"))
+
+
+def _timeit(fn, device, repeats=2):
+    fn()  # warm-up
+    if device.type == "cuda":
+        torch.cuda.synchronize(device)
+    tic = time.perf_counter()
+    for _ in range(repeats):
+        fn()
+    if device.type == "cuda":
+        torch.cuda.synchronize(device)
+    return (time.perf_counter() - tic) / repeats
+
+
+@torch.no_grad()
+def calibrate(pipe, sizes=((240, 416), (352, 640), (480, 832)), num_frames=(17, 33)):
+    """
+    Benchmark the loaded pipeline on synthetic inputs and fit a `CostModel` for the current device.
+    """
+    device = pipe._execution_device
+    transformer = pipe.transformer
+    dtype = transformer.dtype
+    z_dim = pipe.vae.config.z_dim
+    in_channels = transformer.config.in_channels
+    text_dim = transformer.config.text_dim
+    image_dim = transformer.config.image_dim or 1280
+
+    dit_rows, dit_times, mem_rows, mem_values = [], [], [], []
+    enc_rows, enc_times, dec_rows, dec_times = [], [], [], []
+    for height, width in sizes:
+        for frames in num_frames:
+            shape = get_request_shape(height, width, frames)
+            latent_frames = (frames - 1) // pipe.vae_scale_factor_temporal + 1
+            lh, lw = height // pipe.vae_scale_factor_spatial, width // pipe.vae_scale_factor_spatial
+
+            hidden_states = torch.randn(1, in_channels, latent_frames, lh, lw, device=device, dtype=dtype)
+            add_cond = torch.randn(1, transformer.config.add_cond_in_dim, latent_frames, lh, lw, device=device,
+                                   dtype=dtype)
+            attn_cond = torch.randn(1, transformer.config.attn_cond_in_dim, 1, lh, lw, device=device, dtype=dtype)
+            encoder_hidden_states = torch.randn(1, 512, text_dim, device=device, dtype=dtype)
+            encoder_hidden_states_image = torch.randn(1, 257, image_dim, device=device, dtype=dtype)
+            timestep = torch.tensor([500], device=device)
+
+            if device.type == "cuda":
+                torch.cuda.reset_peak_memory_stats(device)
+            seconds = _timeit(lambda: transformer(
+                hidden_states=hidden_states,
+                timestep=timestep,
+                encoder_hidden_states=encoder_hidden_states,
+                encoder_hidden_states_image=encoder_hidden_states_image,
+                return_dict=False,
+                add_cond=add_cond,
+                attn_cond=attn_cond,
+            ), device)
+            dit_rows.append([1, shape["num_tokens"], shape["num_tokens"] ** 2])
+            dit_times.append(seconds)
+            if device.type == "cuda":
+                mem_rows.append([1, shape["num_tokens"]])
+                mem_values.append(torch.cuda.max_memory_allocated(device))
+
+            video = torch.zeros(1, 3, frames, height, width, device=device, dtype=pipe.vae.dtype)
+            enc_rows.append([1, shape["num_pixels"]])
+            enc_times.append(_timeit(lambda: pipe.vae.encode(video), device, repeats=1))
+            latents = torch.zeros(1, z_dim, latent_frames, lh, lw, device=device, dtype=pipe.vae.dtype)
+            dec_rows.append([1, shape["num_pixels"]])
+            dec_times.append(_timeit(lambda: pipe.vae.decode(latents), device, repeats=1))
+
+    def _fit(rows, values):
+        return np.maximum(np.linalg.lstsq(np.array(rows, dtype=np.float64), np.array(values), rcond=None)[0], 0)
+
+    text_time = _timeit(lambda: pipe.encode_prompt("calibration", device=device), device)
+    coefficients = {
+        "dit": _fit(dit_rows, dit_times).tolist(),
+        "encode": _fit(enc_rows, enc_times).tolist(),
+        "decode": _fit(dec_rows, dec_times).tolist(),
+        "text": text_time,
+        "memory": _fit(mem_rows, mem_values).tolist() if mem_rows else [0.0, 0.0],
+    }
+    device_name = torch.cuda.get_device_name(device) if device.type == "cuda" else str(device)
+    return CostModel(coefficients, device_name)
+
+
+class AdmissionController:
+    """
+    Admission control and ETA reporting on top of a `CostModel`.
+
+    A request is rejected when its predicted peak memory exceeds `memory_limit`, or when it cannot meet its
+    deadline given the predicted backlog of queued and running jobs.
+    """
+
+    def __init__(self, cost_model, memory_limit=None, max_backlog=None):
+        self.cost_model = cost_model
+        self.memory_limit = memory_limit
+        self.max_backlog = max_backlog
+
+    def check(self, cost, backlog, deadline=None, now=None):
+        """
+        Returns (admitted, reason, eta), where `eta` is the predicted finish time of the request.
+        """
+        now = now or time.time()
+        eta = now + backlog + cost["total"]
+        if self.memory_limit is not None and cost["memory"] > self.memory_limit:
+            return False, f"Predicted memory {cost['memory'] / 2 ** 30:.1f} GiB exceeds the limit.", eta
+        if self.max_backlog is not None and backlog > self.max_backlog:
+            return False, f"Backlog of {backlog:.0f}s exceeds the limit of {self.max_backlog:.0f}s.", eta
+        if deadline is not None and eta > deadline:
+            return False, f"Predicted finish in {eta - now:.0f}s misses the deadline.", eta
+        return True, None, eta
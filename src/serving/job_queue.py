@@ -0,0 +1,175 @@
+# Copyright 2025 The RealisDance-DiT Team. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+import itertools
+import threading
+import time
+import uuid
+
+from collections import OrderedDict, deque
+
+
+class Job:
+    """
+    A generation request. `bucket` is the (height, width, num_frames) the request will run at. `deadline` is an
+    optional unix time the request should finish by, `cost` its predicted latency in seconds.
+    """
+
+    QUEUED = "queued"
+    RUNNING = "running"
+    DONE = "done"
+    FAILED = "failed"
+
+    _counter = itertools.count()
+
+    def __init__(self, params, bucket, deadline=None, cost=None):
+        self.id = uuid.uuid4().hex
+        self.seq = next(self._counter)
+        self.params = params
+        self.bucket = tuple(bucket)
+        self.deadline = deadline
+        self.cost = cost
+        self.eta = None
+        self.status = Job.QUEUED
+        self.result = None
+        self.error = None
+        self.created = time.time()
+        self.started = None
+        self.finished = None
+
+    def to_dict(self):
+        return {
+            "id": self.id,
+            "status": self.status,
+            "bucket": list(self.bucket),
+            "result": self.result,
+            "error": self.error,
+            "created": self.created,
+            "started": self.started,
+            "finished": self.finished,
+            "deadline": self.deadline,
+            "eta": self.eta,
+        }
+
+
+class BucketedJobQueue:
+    """
+    Job queue grouped by shape bucket.
+
+    The consumer keeps taking jobs from the bucket it ran last, so consecutive generations share shapes and reuse
+    cached or compiled state. After `max_streak` jobs in a row from one bucket, or when it runs empty, it switches
+    to the bucket holding the oldest queued job, so no bucket starves. Jobs with a deadline bypass the buckets and
+    go first, earliest deadline first.
+
+    Finished jobs stay available to `lookup` for `retention` seconds, and at most the last `max_finished` of them.
+    """
+
+    def __init__(self, max_streak=8, retention=3600.0, max_finished=1000):
+        self.max_streak = max_streak
+        self.retention = retention
+        self.max_finished = max_finished
+        self._buckets = OrderedDict()
+        self._jobs = {}
+        self._finished = deque()
+        self._current = None
+        self._streak = 0
+        self._cond = threading.Condition()
+
+    def put(self, job):
+        with self._cond:
+            self._jobs[job.id] = job
+            self._buckets.setdefault(job.bucket, deque()).append(job)
+            self._cond.notify()
+        return job
+
+    def _select_bucket(self):
+        if (
+            self._current in self._buckets and
+            self._buckets[self._current] and
+            self._streak < self.max_streak
+        ):
+            return self._current
+        return min(
+            (bucket for bucket, jobs in self._buckets.items() if jobs),
+            key=lambda bucket: self._buckets[bucket][0].seq,
+        )
+
+    def _select_job(self):
+        urgent = [job for jobs in self._buckets.values() for job in jobs if job.deadline is not None]
+        if urgent:
+            job = min(urgent, key=lambda job: (job.deadline, job.seq))
+            self._buckets[job.bucket].remove(job)
+            return job
+        return self._buckets[self._select_bucket()].popleft()
+
+    def get(self, timeout=None):
+        """
+        Pop the next job and mark it running. Returns `None` on timeout.
+        """
+        with self._cond:
+            if not self._cond.wait_for(lambda: len(self) > 0, timeout=timeout):
+                return None
+            job = self._select_job()
+            bucket = job.bucket
+            self._streak = self._streak + 1 if bucket == self._current else 1
+            self._current = bucket
+            if not self._buckets[bucket]:
+                del self._buckets[bucket]
+            job.status = Job.RUNNING
+            job.started = time.time()
+            if job.cost is not None:
+                job.eta = job.started + job.cost
+            return job
+
+    def finish(self, job):
+        """
+        Record that a job is done or failed, and evict the expired finished jobs.
+        """
+        with self._cond:
+            self._finished.append(job)
+            self._evict(job.finished)
+
+    def _evict(self, now):
+        while self._finished and (
+            len(self._finished) > self.max_finished or
+            self._finished[0].finished < now - self.retention
+        ):
+            self._jobs.pop(self._finished.popleft().id, None)
+
+    def lookup(self, job_id):
+        with self._cond:
+            self._evict(time.time())
+            return self._jobs.get(job_id)
+
+    def backlog(self, now=None):
+        """
+        Predicted seconds until all queued and running jobs are done, from the `cost` of each job.
+        """
+        now = now or time.time()
+        with self._cond:
+            total = 0.0
+            for job in self._jobs.values():
+                if job.cost is None:
+                    continue
+                if job.status == Job.QUEUED:
+                    total += job.cost
+                elif job.status == Job.RUNNING:
+                    total += max(job.started + job.cost - now, 0.0)
+            return total
+
+    def depth(self):
+        with self._cond:
+            return {"x".join(str(x) for x in bucket): len(jobs) for bucket, jobs in self._buckets.items()}
+
+    def __len__(self):
+        return sum(len(jobs) for jobs in self._buckets.values())
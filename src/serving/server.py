@@ -0,0 +1,202 @@
+# Copyright 2025 The RealisDance-DiT Team. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+"""
+Local inference server.
+
+Endpoints (json in, json out):
+    POST /jobs                 submit a job, returns {"id": ...}, 503 when rejected by admission control
+    GET  /jobs/<id>            job status, including the predicted finish time `eta`
+    GET  /jobs/<id>/result     the generated mp4 once the job is done
+    GET  /health               queue depth per bucket and predicted backlog in seconds
+    GET  /metrics              Prometheus metrics, when the service has a `MetricsRegistry`
+
+A job may set `deadline`, the unix time it should finish by.
+
+`address` is `host:port` for HTTP over TCP or `unix:<path>` for HTTP over a unix socket.
+"""
+import json
+import os
+import socketserver
+import threading
+import time
+import traceback
+
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+from .job_queue import BucketedJobQueue, Job
+
+
+class AdmissionError(Exception):
+    pass
+
+
+class _UnixHTTPServer(socketserver.ThreadingMixIn, socketserver.UnixStreamServer):
+    daemon_threads = True
+
+
+class _Handler(BaseHTTPRequestHandler):
+    server_version = "RealisDanceServer/1.0"
+
+    def address_string(self):
+        # unix sockets have no client address
+        return self.client_address[0] if self.client_address else "unix"
+
+    def log_message(self, format, *args):
+        pass
+
+    def _send_json(self, code, payload):
+        body = json.dumps(payload).encode("utf-8")
+        self.send_response(code)
+        self.send_header("Content-Type", "application/json")
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def do_POST(self):
+        service = self.server.service
+        if self.path.rstrip("/") != "/jobs":
+            return self._send_json(404, {"error": f"Unknown path {self.path}"})
+        try:
+            length = int(self.headers.get("Content-Length", 0))
+            params = json.loads(self.rfile.read(length).decode("utf-8"))
+            job = service.submit(params)
+        except AdmissionError as e:
+            return self._send_json(503, {"error": str(e)})
+        except Exception as e:
+            return self._send_json(400, {"error": str(e)})
+        return self._send_json(200, {"id": job.id, "bucket": list(job.bucket), "eta": job.eta})
+
+    def do_GET(self):
+        service = self.server.service
+        parts = [p for p in self.path.split("/") if p]
+        if parts == ["health"]:
+            return self._send_json(200, service.health())
+        if parts == ["metrics"] and service.metrics is not None:
+            body = service.metrics.render().encode("utf-8")
+            self.send_response(200)
+            self.send_header("Content-Type", "text/plain; version=0.0.4; charset=utf-8")
+            self.send_header("Content-Length", str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
+            return
+        if len(parts) in (2, 3) and parts[0] == "jobs":
+            job = service.queue.lookup(parts[1])
+            if job is None:
+                return self._send_json(404, {"error": f"Unknown job {parts[1]}"})
+            if len(parts) == 2:
+                return self._send_json(200, job.to_dict())
+            if parts[2] == "result":
+                if job.status != Job.DONE:
+                    return self._send_json(409, {"error": f"Job {job.id} is {job.status}"})
+                with open(job.result, "rb") as f:
+                    body = f.read()
+                self.send_response(200)
+                self.send_header("Content-Type", "video/mp4")
+                self.send_header("Content-Length", str(len(body)))
+                self.end_headers()
+                self.wfile.write(body)
+                return
+        return self._send_json(404, {"error": f"Unknown path {self.path}"})
+
+
+class InferenceService:
+    """
+    Keep a pipeline resident and run queued jobs in worker threads.
+
+    Args:
+        run_job (`Callable[[Job], str]`): runs one job on the resident pipeline and returns the output path.
+        get_bucket (`Callable[[dict], Tuple[int, int, int]]`): maps job params to (height, width, num_frames).
+            Called at submission, so that invalid requests fail before being queued.
+        num_workers (`int`): number of jobs run concurrently, more than one only makes sense when `run_job`
+            hands the job to a batching scheduler such as `StepBatcher`.
+        get_cost (`Callable[[dict, Tuple[int, int, int]], dict]`, *optional*): maps job params and bucket to the
+            `CostModel.predict` output. Enables ETA reporting.
+        admission (`AdmissionController`, *optional*): rejects jobs that do not fit the memory, backlog or
+            deadline budget. Requires `get_cost`.
+        metrics (`MetricsRegistry`, *optional*): counts jobs by outcome, tracks the queue depth and serves both
+            on `GET /metrics`.
+    """
+
+    def __init__(
+        self, run_job, get_bucket, max_streak=8, num_workers=1, get_cost=None, admission=None, metrics=None
+    ):
+        if admission is not None and get_cost is None:
+            raise ValueError("`admission` requires `get_cost`.")
+        self.run_job = run_job
+        self.get_bucket = get_bucket
+        self.get_cost = get_cost
+        self.admission = admission
+        self.queue = BucketedJobQueue(max_streak=max_streak)
+        self.metrics = metrics
+        if metrics is not None:
+            metrics.gauge("queue_depth", "Queued jobs.").set_function(lambda: len(self.queue))
+        self._stop = threading.Event()
+        self._workers = [threading.Thread(target=self._loop, daemon=True) for _ in range(num_workers)]
+
+    def submit(self, params):
+        bucket = self.get_bucket(params)
+        deadline = params.get("deadline")
+        job = Job(params, bucket, deadline=deadline)
+        if self.get_cost is not None:
+            cost = self.get_cost(params, bucket)
+            job.cost = cost["total"]
+            backlog = self.queue.backlog()
+            if self.admission is not None:
+                admitted, reason, job.eta = self.admission.check(cost, backlog, deadline=deadline)
+                if not admitted:
+                    if self.metrics is not None:
+                        self.metrics.inc_request("rejected")
+                    raise AdmissionError(reason)
+            else:
+                job.eta = time.time() + backlog + job.cost
+        return self.queue.put(job)
+
+    def health(self):
+        return {"queued": len(self.queue), "buckets": self.queue.depth(), "backlog": self.queue.backlog()}
+
+    def _loop(self):
+        while not self._stop.is_set():
+            job = self.queue.get(timeout=1.0)
+            if job is None:
+                continue
+            try:
+                job.result = self.run_job(job)
+                job.status = Job.DONE
+            except Exception:
+                job.error = traceback.format_exc()
+                job.status = Job.FAILED
+                print(f"WARNING: Job {job.id} failed.\n{job.error}")
+            job.finished = time.time()
+            self.queue.finish(job)
+            if self.metrics is not None:
+                self.metrics.inc_request(job.status)
+
+    def serve_forever(self, address):
+        if address.startswith("unix:"):
+            path = address[len("unix:"):]
+            if os.path.exists(path):
+                os.remove(path)
+            httpd = _UnixHTTPServer(path, _Handler)
+        else:
+            host, port = address.rsplit(":", 1)
+            httpd = ThreadingHTTPServer((host, int(port)), _Handler)
+        httpd.service = self
+        for worker in self._workers:
+            worker.start()
+        print(f"Serving on {address}")
+        try:
+            httpd.serve_forever()
+        finally:
+            self._stop.set()
+            httpd.server_close()
@@ -22,15 +22,6 @@ import torch.distributed as dist
 from datetime import timedelta
 from functools import partial
 
-from torch.distributed.fsdp import FullyShardedDataParallel as FSDP
-from torch.distributed.fsdp import MixedPrecision, ShardingStrategy
-from torch.distributed.fsdp.wrap import lambda_auto_wrap_policy
-
-from xfuser.core.distributed import (
-    init_distributed_environment,
-    initialize_model_parallel,
-)
-
 
 def set_seed(seed):
     random.seed(seed)
@@ -75,10 +66,17 @@ def shard_model(
     reduce_dtype=torch.float32,
     buffer_dtype=torch.bfloat16,
     process_group=None,
-    sharding_strategy=ShardingStrategy.FULL_SHARD,
+    sharding_strategy=None,
     sync_module_states=True,
     model_type="wan"
 ):
+    # FSDP is only needed for multi-GPU inference, import it lazily to keep single GPU start-up fast
+    from torch.distributed.fsdp import FullyShardedDataParallel as FSDP
+    from torch.distributed.fsdp import MixedPrecision, ShardingStrategy
+    from torch.distributed.fsdp.wrap import lambda_auto_wrap_policy
+
+    if sharding_strategy is None:
+        sharding_strategy = ShardingStrategy.FULL_SHARD
     model = model.to(torch.float32)
     if model_type == "wan":
         block_list = list(model.blocks)
@@ -108,6 +106,8 @@ def shard_model(
 
 
 def init_dist():
+    from xfuser.core.distributed import init_distributed_environment, initialize_model_parallel
+
     dist.init_process_group("cpu:gloo,cuda:nccl", timeout=timedelta(hours=24))
     world_size = get_world_size()
     rank = get_rank()
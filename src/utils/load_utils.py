@@ -0,0 +1,111 @@
+# Copyright 2025 The RealisDance-DiT Team. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+import importlib
+import json
+import os
+import time
+
+from concurrent.futures import ThreadPoolExecutor
+from contextlib import contextmanager
+
+import torch
+
+
+class StartupTimer:
+    """
+    Collect the wall time of start-up stages and print them as a breakdown.
+    """
+
+    def __init__(self):
+        self.start = time.perf_counter()
+        self.records = []
+
+    @contextmanager
+    def record(self, name):
+        tic = time.perf_counter()
+        try:
+            yield
+        finally:
+            self.records.append((name, time.perf_counter() - tic))
+
+    def add(self, name, seconds):
+        self.records.append((name, seconds))
+
+    def summary(self):
+        lines = ["Start-up time breakdown:"]
+        for name, seconds in self.records:
+            lines.append(f"    {name:<24s} {seconds:8.2f}s")
+        lines.append(f"    {'total':<24s} {time.perf_counter() - self.start:8.2f}s")
+        return "\n".join(lines)
+
+
+def _get_component_class(model_id, name):
+    # resolve tokenizer / text_encoder / scheduler classes from model_index.json like `DiffusionPipeline` does
+    with open(os.path.join(model_id, "model_index.json"), "r", encoding="utf-8") as f:
+        library, class_name = json.load(f)[name]
+    return getattr(importlib.import_module(library), class_name)
+
+
+def load_pipeline_parallel(pipeline_class, model_id, torch_dtype=torch.bfloat16, max_workers=None, timer=None):
+    """
+    Load the components of a RealisDance-DiT pipeline concurrently and assemble the pipeline.
+
+    `from_pretrained` of a whole pipeline loads the components one after another. Every component here is loaded
+    from its own (memory-mapped) safetensors files in a worker thread instead, so the start-up time is bounded by the
+    largest component rather than their sum. Dtypes follow `inference.py`: CLIP and VAE in float32, T5 and the DiT
+    in `torch_dtype`.
+    """
+    from diffusers import AutoencoderKLWan
+    from transformers import CLIPVisionModel
+
+    from ..models.rd_dit import RealisDanceDiT
+
+    loaders = {
+        "transformer": lambda: RealisDanceDiT.from_pretrained(
+            model_id, subfolder="transformer", torch_dtype=torch_dtype, use_safetensors=True
+        ),
+        "text_encoder": lambda: _get_component_class(model_id, "text_encoder").from_pretrained(
+            model_id, subfolder="text_encoder", torch_dtype=torch_dtype, use_safetensors=True
+        ),
+        "image_encoder": lambda: CLIPVisionModel.from_pretrained(
+            model_id, subfolder="image_encoder", torch_dtype=torch.float32, use_safetensors=True
+        ),
+        "vae": lambda: AutoencoderKLWan.from_pretrained(
+            model_id, subfolder="vae", torch_dtype=torch.float32, use_safetensors=True
+        ),
+        "tokenizer": lambda: _get_component_class(model_id, "tokenizer").from_pretrained(
+            model_id, subfolder="tokenizer"
+        ),
+        "scheduler": lambda: _get_component_class(model_id, "scheduler").from_pretrained(
+            model_id, subfolder="scheduler"
+        ),
+    }
+
+    def _load(name):
+        tic = time.perf_counter()
+        component = loaders[name]()
+        return component, time.perf_counter() - tic
+
+    tic = time.perf_counter()
+    with ThreadPoolExecutor(max_workers=max_workers or len(loaders)) as executor:
+        futures = {name: executor.submit(_load, name) for name in loaders}
+        components = {}
+        for name, future in futures.items():
+            components[name], seconds = future.result()
+            if timer is not None:
+                timer.add(f"load {name}", seconds)
+    if timer is not None:
+        timer.add("load all (wall)", time.perf_counter() - tic)
+
+    return pipeline_class(**components)
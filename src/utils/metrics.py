@@ -0,0 +1,296 @@
+# Copyright 2025 The RealisDance-DiT Team. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+"""
+Dependency-free metrics registry rendered in the Prometheus text exposition format.
+
+    metrics = MetricsRegistry()
+    pipe.enable_metrics(metrics)
+    metrics.serve("127.0.0.1:9400")            # GET /metrics
+    metrics.dump_periodically("./metrics.prom")  # or a file, e.g., for the node exporter textfile collector
+
+Stage timers synchronize the device, so that the recorded latency is the one of the GPU work and not of the launch.
+"""
+import contextlib
+import math
+import os
+import threading
+import time
+
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+import torch
+
+# seconds, from a VAE decode of a small video to a full generation
+DEFAULT_BUCKETS = (0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 25, 50, 100, 250, 500, 1000)
+
+
+def _format_labels(names, values, extra=()):
+    pairs = list(zip(names, values)) + list(extra)
+    if not pairs:
+        return ""
+    escaped = (str(v).replace("\\", "\\\\").replace("\n", "\\n").replace('"', '\\"') for _, v in pairs)
+    return "{" + ",".join(f'{k}="{v}"' for (k, _), v in zip(pairs, escaped)) + "}"
+
+
+def _format_value(value):
+    if value == math.inf:
+        return "+Inf"
+    return repr(float(value))
+
+
+class _Metric:
+    type = None
+
+    def __init__(self, name, documentation, labelnames=()):
+        self.name = name
+        self.documentation = documentation
+        self.labelnames = tuple(labelnames)
+        self._lock = threading.Lock()
+        self._values = {}
+
+    def _key(self, labels):
+        if set(labels) != set(self.labelnames):
+            raise ValueError(f"{self.name} expects labels {self.labelnames}, but got {tuple(labels)}.")
+        return tuple(str(labels[k]) for k in self.labelnames)
+
+    def _samples(self):
+        raise NotImplementedError
+
+    def render(self):
+        lines = [f"# HELP {self.name} {self.documentation}", f"# TYPE {self.name} {self.type}"]
+        for name, labels, extra, value in self._samples():
+            lines.append(f"{name}{_format_labels(self.labelnames, labels, extra)} {_format_value(value)}")
+        return "\n".join(lines)
+
+
+class Counter(_Metric):
+    type = "counter"
+
+    def inc(self, amount=1, **labels):
+        key = self._key(labels)
+        with self._lock:
+            self._values[key] = self._values.get(key, 0) + amount
+
+    def get(self, **labels):
+        return self._values.get(self._key(labels), 0)
+
+    def _samples(self):
+        with self._lock:
+            return [(self.name, k, (), v) for k, v in sorted(self._values.items())]
+
+
+class Gauge(_Metric):
+    type = "gauge"
+
+    def __init__(self, name, documentation, labelnames=()):
+        super().__init__(name, documentation, labelnames)
+        self._functions = {}
+
+    def set(self, value, **labels):
+        key = self._key(labels)
+        with self._lock:
+            self._values[key] = value
+
+    def set_max(self, value, **labels):
+        # high-water mark
+        key = self._key(labels)
+        with self._lock:
+            self._values[key] = max(self._values.get(key, value), value)
+
+    def set_function(self, fn, **labels):
+        """
+        Evaluate `fn()` at every render instead of storing a value, e.g., for queue depths.
+        """
+        self._functions[self._key(labels)] = fn
+
+    def _samples(self):
+        with self._lock:
+            values = dict(self._values)
+        for key, fn in list(self._functions.items()):
+            values[key] = fn()
+        return [(self.name, k, (), v) for k, v in sorted(values.items())]
+
+
+class Histogram(_Metric):
+    type = "histogram"
+
+    def __init__(self, name, documentation, labelnames=(), buckets=DEFAULT_BUCKETS):
+        super().__init__(name, documentation, labelnames)
+        self.buckets = tuple(sorted(buckets)) + (math.inf,)
+
+    def observe(self, value, **labels):
+        key = self._key(labels)
+        with self._lock:
+            counts, total = self._values.get(key, ([0] * len(self.buckets), 0.0))
+            for i, bound in enumerate(self.buckets):
+                if value <= bound:
+                    counts[i] += 1
+            self._values[key] = (counts, total + value)
+
+    def _samples(self):
+        samples = []
+        with self._lock:
+            for key, (counts, total) in sorted(self._values.items()):
+                for bound, count in zip(self.buckets, counts):
+                    samples.append((f"{self.name}_bucket", key, (("le", _format_value(bound)),), count))
+                samples.append((f"{self.name}_count", key, (), counts[-1]))
+                samples.append((f"{self.name}_sum", key, (), total))
+        return samples
+
+
+class MetricsRegistry:
+    r"""
+    The metrics of one process. Metrics are created on first use and shared by name, so the pipeline, the job
+    queue and the batch loop can all report to one registry.
+
+    Standard metrics (all prefixed with `realisdance_`):
+        requests_total{status}                    jobs or batch samples, by `done` / `failed` / `rejected`
+        stage_seconds{stage}                      latency of `encode`, `step` (one DiT step with CFG), `decode`,
+                                                  `export`, and of whole `generation`s
+        teacache_forwards_total{result}           transformer forwards `computed` or `skipped` by TeaCache
+        cache_requests_total{cache,result}        `hit` / `miss` of the caches of the pipeline, e.g., `plan`
+        queue_depth                               queued jobs
+        device_memory_peak_bytes{device}          CUDA memory high-water mark of every visible device
+    """
+
+    def __init__(self, prefix="realisdance_"):
+        self.prefix = prefix
+        self._metrics = {}
+        self._lock = threading.Lock()
+        self.gauge("device_memory_peak_bytes", "Peak allocated device memory.", ["device"])
+
+    def _get(self, cls, name, documentation, labelnames, **kwargs):
+        name = self.prefix + name
+        with self._lock:
+            if name not in self._metrics:
+                self._metrics[name] = cls(name, documentation, labelnames, **kwargs)
+            metric = self._metrics[name]
+        if not isinstance(metric, cls):
+            raise ValueError(f"{name} is already registered as a {metric.type}.")
+        return metric
+
+    def counter(self, name, documentation="", labelnames=()):
+        return self._get(Counter, name, documentation, labelnames)
+
+    def gauge(self, name, documentation="", labelnames=()):
+        return self._get(Gauge, name, documentation, labelnames)
+
+    def histogram(self, name, documentation="", labelnames=(), buckets=DEFAULT_BUCKETS):
+        return self._get(Histogram, name, documentation, labelnames, buckets=buckets)
+
+    # shortcuts for the standard metrics
+
+    def inc_request(self, status):
+        self.counter("requests_total", "Processed requests.", ["status"]).inc(status=status)
+
+    def observe_stage(self, stage, seconds):
+        self.histogram("stage_seconds", "Latency per stage.", ["stage"]).observe(seconds, stage=stage)
+
+    def inc_teacache(self, skipped):
+        self.counter("teacache_forwards_total", "Transformer forwards by TeaCache decision.", ["result"]).inc(
+            result="skipped" if skipped else "computed"
+        )
+
+    def inc_cache(self, cache, hit):
+        self.counter("cache_requests_total", "Cache lookups.", ["cache", "result"]).inc(
+            cache=cache, result="hit" if hit else "miss"
+        )
+
+    @staticmethod
+    def _synchronize(device):
+        if device is not None and torch.device(device).type == "cuda":
+            torch.cuda.synchronize(device)
+
+    def start_timer(self, device=None):
+        self._synchronize(device)
+        return time.perf_counter()
+
+    def stop_timer(self, stage, start, device=None):
+        """
+        Record the time since `start_timer` as `stage`, after the pending work on `device` is done.
+        """
+        self._synchronize(device)
+        self.observe_stage(stage, time.perf_counter() - start)
+
+    @contextlib.contextmanager
+    def time_stage(self, stage, device=None):
+        start = self.start_timer(device)
+        yield
+        self.stop_timer(stage, start, device)
+
+    def _update_device_memory(self):
+        if not torch.cuda.is_available() or not torch.cuda.is_initialized():
+            return
+        gauge = self.gauge("device_memory_peak_bytes")
+        for i in range(torch.cuda.device_count()):
+            gauge.set_max(torch.cuda.max_memory_allocated(i), device=f"cuda:{i}")
+
+    def render(self):
+        """
+        All metrics in the Prometheus text format.
+        """
+        self._update_device_memory()
+        with self._lock:
+            metrics = list(self._metrics.values())
+        return "\n".join(metric.render() for metric in metrics) + "\n"
+
+    def dump(self, path):
+        # write then rename, so that a scraper never reads a partial file
+        with open(path + ".tmp", "w", encoding="utf-8") as f:
+            f.write(self.render())
+        os.replace(path + ".tmp", path)
+
+    def dump_periodically(self, path, interval=15.0):
+        """
+        Dump to `path` every `interval` seconds from a daemon thread. Returns a stop function that dumps once more.
+        """
+        stop = threading.Event()
+
+        def loop():
+            while not stop.wait(interval):
+                self.dump(path)
+
+        threading.Thread(target=loop, daemon=True).start()
+
+        def stop_and_dump():
+            stop.set()
+            self.dump(path)
+
+        return stop_and_dump
+
+    def serve(self, address):
+        """
+        Serve GET /metrics on `host:port` from a daemon thread. Returns the HTTP server.
+        """
+        registry = self
+
+        class Handler(BaseHTTPRequestHandler):
+            def log_message(self, format, *args):
+                pass
+
+            def do_GET(self):
+                if self.path.rstrip("/") != "/metrics":
+                    self.send_error(404)
+                    return
+                body = registry.render().encode("utf-8")
+                self.send_response(200)
+                self.send_header("Content-Type", "text/plain; version=0.0.4; charset=utf-8")
+                self.send_header("Content-Length", str(len(body)))
+                self.end_headers()
+                self.wfile.write(body)
+
+        host, port = address.rsplit(":", 1)
+        httpd = ThreadingHTTPServer((host, int(port)), Handler)
+        threading.Thread(target=httpd.serve_forever, daemon=True).start()
+        return httpd
@@ -0,0 +1,177 @@
+# Copyright 2025 The RealisDance-DiT Team. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+"""
+Packed pose-condition bundle.
+
+A bundle stores the SMPL and HaMeR streams of one sample frame-aligned at a fixed fps, pre-resized to one or
+more resolution levels. Layout of a `.rdpb` file:
+
+    | magic (8 bytes) | index length (uint64, little endian) | json index | padding | page-aligned frame data |
+
+The json index records, for every level, the `max_resolution` it was built for, the target (height, width) and the
+byte offset of the `smpl` / `hamer` arrays. Every array is uint8 in T H W C layout, so a frame range of one level
+is a single contiguous slice of the memory-mapped file.
+"""
+import json
+
+import numpy as np
+import torch
+import torch.nn.functional as F
+
+from ..pipelines.rd_dit_pipeline import compute_target_size
+
+BUNDLE_MAGIC = b"RDPB0001"
+BUNDLE_ALIGN = 4096
+BUNDLE_STREAMS = ("smpl", "hamer")
+# vae_scale_factor_spatial * patch_size of RealisDance-DiT
+BUNDLE_SCALE_FACTOR = 16
+
+
+def _align(offset, alignment=BUNDLE_ALIGN):
+    return (offset + alignment - 1) // alignment * alignment
+
+
+def get_target_shape(ori_h, ori_w, max_resolution, scale_factor=BUNDLE_SCALE_FACTOR):
+    # same as `RealisDanceDiTPipeline.get_target_size` when `height` / `width` are not given
+    return compute_target_size(ori_h, ori_w, max_resolution, (scale_factor, scale_factor))
+
+
+def resize_crop(video, tgt_h, tgt_w):
+    # same as `RealisDanceDiTPipeline.process_shape(..., resize_type="resize_crop")`, on uint8 T H W C frames
+    ori_h, ori_w = video.shape[1:3]
+    if (ori_h, ori_w) == (tgt_h, tgt_w):
+        return video
+    ratio_h, ratio_w = tgt_h / ori_h, tgt_w / ori_w
+    if ratio_h > ratio_w:
+        h, w = tgt_h, round(ori_w * ratio_h)
+        i = 0
+        j = int(round(w - tgt_w) / 2.0)
+    else:
+        h, w = round(ori_h * ratio_w), tgt_w
+        i = int(round(h - tgt_h) / 2.0)
+        j = 0
+    video = video.permute(0, 3, 1, 2).float()
+    video = F.interpolate(video, size=(h, w), mode='bicubic', align_corners=False)
+    video = video[..., i:i + tgt_h, j:j + tgt_w]
+    return video.round().clamp(0, 255).to(torch.uint8).permute(0, 2, 3, 1).contiguous()
+
+
+def write_pose_bundle(path, smpl, hamer, max_resolutions, fps=16, chunk_size=16):
+    """
+    Write a pose bundle.
+
+    Args:
+        path (`str`): output path.
+        smpl (`torch.Tensor`): uint8 SMPL frames in T H W C, already resampled to `fps`. The levels are sized
+            from its resolution.
+        hamer (`torch.Tensor`): uint8 HaMeR frames in T H W C, frame-aligned with `smpl`. It may have another
+            resolution, every stream is resized to the level shape on its own, as in the pipeline.
+        max_resolutions (`List[int]`): the `max_resolution` of every level to store.
+        fps (`int`): frame rate of the streams.
+        chunk_size (`int`): number of frames resized at once.
+    """
+    if smpl.shape[0] != hamer.shape[0] or smpl.shape[3] != hamer.shape[3]:
+        raise ValueError(
+            f"`smpl` and `hamer` should have the same number of frames and channels, but got {tuple(smpl.shape)} "
+            f"and {tuple(hamer.shape)}."
+        )
+    num_frames, ori_h, ori_w, num_channels = smpl.shape
+
+    levels = []
+    for max_resolution in sorted(set(max_resolutions)):
+        h, w = get_target_shape(ori_h, ori_w, max_resolution)
+        if any(level["height"] == h and level["width"] == w for level in levels):
+            continue
+        levels.append({"max_resolution": max_resolution, "height": h, "width": w})
+
+    # data offsets are relative to the start of the data section
+    offset = 0
+    for level in levels:
+        nbytes = num_frames * level["height"] * level["width"] * num_channels
+        for name in BUNDLE_STREAMS:
+            level[name] = offset
+            offset = _align(offset + nbytes)
+
+    index = json.dumps({
+        "fps": fps,
+        "num_frames": num_frames,
+        "num_channels": num_channels,
+        "source_height": ori_h,
+        "source_width": ori_w,
+        "levels": levels,
+    }).encode("utf-8")
+    data_start = _align(len(BUNDLE_MAGIC) + 8 + len(index))
+
+    with open(path, "wb") as f:
+        f.write(BUNDLE_MAGIC)
+        f.write(np.uint64(len(index)).tobytes())
+        f.write(index)
+        for level in levels:
+            for name, video in zip(BUNDLE_STREAMS, (smpl, hamer)):
+                f.seek(data_start + level[name])
+                for start in range(0, num_frames, chunk_size):
+                    chunk = resize_crop(video[start:start + chunk_size], level["height"], level["width"])
+                    f.write(chunk.numpy().tobytes())
+        f.truncate(data_start + offset)
+
+
+class PoseBundle:
+    """
+    Read-only, memory-mapped view of a pose bundle written by `write_pose_bundle`.
+    """
+
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            magic = f.read(len(BUNDLE_MAGIC))
+            if magic != BUNDLE_MAGIC:
+                raise ValueError(f"{path} is not a pose bundle.")
+            index_len = int(np.frombuffer(f.read(8), dtype=np.uint64)[0])
+            self.index = json.loads(f.read(index_len).decode("utf-8"))
+        self.path = path
+        self.fps = self.index["fps"]
+        self.num_frames = self.index["num_frames"]
+        self.num_channels = self.index["num_channels"]
+        self.source_height = self.index["source_height"]
+        self.source_width = self.index["source_width"]
+        self.levels = self.index["levels"]
+        self._data_start = _align(len(BUNDLE_MAGIC) + 8 + index_len)
+        self._mmap = np.memmap(path, dtype=np.uint8, mode="r")
+
+    def __len__(self):
+        return self.num_frames
+
+    def get_level(self, max_resolution):
+        """
+        Return the level built for `max_resolution`, or the smallest level above it if there is no exact match.
+        """
+        levels = sorted(self.levels, key=lambda x: x["max_resolution"])
+        for level in levels:
+            if level["max_resolution"] >= max_resolution:
+                return level
+        return levels[-1]
+
+    def get_target_shape(self, max_resolution):
+        return get_target_shape(self.source_height, self.source_width, max_resolution)
+
+    def get_frames(self, level, name, frame_index):
+        """
+        Return uint8 frames of stream `name` at `level` in T H W C. `frame_index` is a slice or a list of indices.
+        """
+        if name not in BUNDLE_STREAMS:
+            raise ValueError(f"Unknown stream {name}, should be one of {BUNDLE_STREAMS}.")
+        shape = (self.num_frames, level["height"], level["width"], self.num_channels)
+        start = self._data_start + level[name]
+        video = self._mmap[start:start + int(np.prod(shape))].reshape(shape)
+        return video[frame_index]
+
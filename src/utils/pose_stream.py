@@ -0,0 +1,235 @@
+# Copyright 2025 The RealisDance-DiT Team. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+"""
+Streaming pose input.
+
+The producer writes one json header line, followed by frame-aligned (smpl, hamer) frame pairs:
+
+    {"fps": 30, "height": 720, "width": 1280, "format": "raw"}\n
+    | smpl frame | hamer frame | smpl frame | hamer frame | ...
+
+With `"format": "raw"` every frame is height * width * 3 uint8 bytes in RGB order. With `"format": "encoded"` every
+frame is an uint32 (little endian) byte length followed by a png / jpeg image. The stream ends when the producer
+closes the pipe or the socket.
+"""
+import json
+import queue
+import socket
+import struct
+import sys
+import threading
+
+import cv2
+import numpy as np
+import torch
+
+
+def open_pose_stream(uri):
+    """
+    Open a pose stream. `uri` is `-` for stdin, `unix:<path>` for a local socket, otherwise a path to a pipe.
+    """
+    if uri == "-":
+        return sys.stdin.buffer
+    if uri.startswith("unix:"):
+        sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        sock.connect(uri[len("unix:"):])
+        return sock.makefile("rb")
+    return open(uri, "rb")
+
+
+class PoseStreamReader:
+    """
+    Iterate over (smpl, hamer) uint8 H W C frames of a pose stream, resampled to `fps` on the fly.
+
+    Offline `load_video` spreads the frames with `np.linspace` over the whole clip. The length of a stream is not
+    known in advance, so target frame `j` takes the nearest source frame `round(j * src_fps / fps)` instead.
+    """
+
+    def __init__(self, stream, fps=16):
+        self.stream = stream
+        self.fps = fps
+        header = json.loads(stream.readline().decode("utf-8"))
+        self.src_fps = header.get("fps", fps)
+        self.height = header["height"]
+        self.width = header["width"]
+        self.format = header.get("format", "raw")
+        if self.format not in ("raw", "encoded"):
+            raise ValueError(f"Unsupported pose stream format: {self.format}")
+
+    def _read_exact(self, size):
+        data = b""
+        while len(data) < size:
+            chunk = self.stream.read(size - len(data))
+            if not chunk:
+                return None
+            data += chunk
+        return data
+
+    def _read_frame(self):
+        if self.format == "raw":
+            data = self._read_exact(self.height * self.width * 3)
+            if data is None:
+                return None
+            return np.frombuffer(data, dtype=np.uint8).reshape(self.height, self.width, 3)
+        length = self._read_exact(4)
+        if length is None:
+            return None
+        data = self._read_exact(struct.unpack("<I", length)[0])
+        if data is None:
+            return None
+        frame = cv2.imdecode(np.frombuffer(data, dtype=np.uint8), cv2.IMREAD_COLOR)
+        return cv2.cvtColor(frame, cv2.COLOR_BGR2RGB)
+
+    def __iter__(self):
+        src_index = tgt_index = 0
+        while True:
+            smpl = self._read_frame()
+            hamer = self._read_frame()
+            if smpl is None or hamer is None:
+                return
+            # emit every target frame whose nearest source frame is this one (none when downsampling past it)
+            while round(tgt_index * self.src_fps / self.fps) == src_index:
+                yield smpl, hamer
+                tgt_index += 1
+            src_index += 1
+
+
+class StreamingPoseEncoder:
+    """
+    Encode SMPL / HaMeR frames into the pose condition latents while they arrive.
+
+    The Wan VAE encoder is causal in time: the first frame is encoded alone and every following 4 frames form one
+    latent frame, with the temporal context carried in a feature cache. This class keeps one feature cache per
+    stream across `push` calls, so every complete chunk is encoded as soon as its frames arrive, and the result is
+    the same as `vae.encode` on the whole clip.
+    """
+
+    def __init__(self, pipe, height, width, device=None, dtype=torch.float32):
+        self.pipe = pipe
+        self.vae = pipe.vae
+        self.height = height
+        self.width = width
+        self.device = device or pipe._execution_device
+        self.dtype = dtype
+        self.temporal_factor = pipe.vae_scale_factor_temporal
+        self.latents_mean = (
+            torch.tensor(self.vae.config.latents_mean)
+            .view(1, self.vae.config.z_dim, 1, 1, 1)
+            .to(self.device, dtype)
+        )
+        self.latents_std = 1.0 / torch.tensor(self.vae.config.latents_std).view(1, self.vae.config.z_dim, 1, 1, 1).to(
+            self.device, dtype
+        )
+        self._feat_cache = {"smpl": [None] * self.vae._enc_conv_num, "hamer": [None] * self.vae._enc_conv_num}
+        self._pending = {"smpl": [], "hamer": []}
+        self._latents = {"smpl": [], "hamer": []}
+        self.num_frames = 0
+        self.num_encoded_frames = 0
+
+    def _to_video(self, frames):
+        # list of uint8 H W C -> 1 C F H W in [-1, 1], resized to the generation shape
+        video = self.pipe.prepare_input(np.stack(frames), self.device)
+        return self.pipe.process_shape(video, self.height, self.width, resize_type="resize_crop").to(self.dtype)
+
+    @torch.no_grad()
+    def _encode_chunk(self, name, frames):
+        if hasattr(self.vae, "_hf_hook") and hasattr(self.vae._hf_hook, "pre_forward"):
+            # model cpu offload only hooks `vae.forward`, onload the vae by hand like `apply_forward_hook`
+            self.vae._hf_hook.pre_forward(self.vae)
+        video = self._to_video(frames).to(self.vae.dtype)
+        out = self.vae.encoder(video, feat_cache=self._feat_cache[name], feat_idx=[0])
+        enc = self.vae.quant_conv(out)
+        latent = enc[:, :self.vae.config.z_dim].to(self.dtype)  # argmax, i.e., the mean
+        self._latents[name].append((latent - self.latents_mean) * self.latents_std)
+
+    def _chunk_size(self):
+        return 1 if self.num_encoded_frames == 0 else self.temporal_factor
+
+    def push(self, smpl, hamer):
+        """
+        Add one frame-aligned (smpl, hamer) pair of uint8 H W C frames, and encode a chunk if it is complete.
+        """
+        self._pending["smpl"].append(smpl)
+        self._pending["hamer"].append(hamer)
+        self.num_frames += 1
+        if len(self._pending["smpl"]) == self._chunk_size():
+            for name in ("smpl", "hamer"):
+                self._encode_chunk(name, self._pending[name])
+                self._pending[name] = []
+            self.num_encoded_frames = self.num_frames
+
+    @property
+    def num_latent_frames(self):
+        return len(self._latents["smpl"])
+
+    def latents(self):
+        """
+        The pose condition latents encoded so far in B C F H W, e.g., to start generating while frames still arrive.
+        """
+        if self.num_encoded_frames == 0:
+            raise ValueError("No pose frame has been received.")
+        latent_smpl = torch.cat(self._latents["smpl"], dim=2)
+        latent_hamer = torch.cat(self._latents["hamer"], dim=2)
+        return torch.cat((latent_smpl, latent_hamer), dim=1)
+
+    def finish(self):
+        """
+        Return the pose condition latents in B C F H W, i.e., the concatenated smpl and hamer latents.
+        Incomplete trailing chunks are dropped, the VAE only accepts 4k + 1 frames.
+        """
+        latents = self.latents()
+        self._feat_cache = {"smpl": [], "hamer": []}
+        return latents
+
+
+def encode_pose_stream(pipe, stream, max_resolution, num_frames=81, fps=16, height=None, width=None):
+    """
+    Read a pose stream and encode it chunk by chunk. Stops after `num_frames` frames; a stream that ends early
+    is padded by repeating its last frame.
+
+    Returns:
+        pose latents in B C F H W, and the (height, width) of the generation.
+    """
+    reader = PoseStreamReader(stream, fps=fps)
+    if height is None or width is None:
+        # `compute_target_size` with the scale factors of the pipeline
+        height, width = pipe.get_target_size(reader.height, reader.width, max_resolution)
+
+    # read in a background thread, so that the producer is never blocked on a full pipe while we encode
+    frames = queue.Queue()
+
+    def _read():
+        try:
+            for pair in reader:
+                frames.put(pair)
+        finally:
+            frames.put(None)
+
+    threading.Thread(target=_read, daemon=True).start()
+
+    encoder = StreamingPoseEncoder(pipe, height, width)
+    last = None
+    while encoder.num_frames < num_frames:
+        pair = frames.get()
+        if pair is None:
+            break
+        encoder.push(*pair)
+        last = pair
+    if last is None:
+        raise ValueError("The pose stream ended before any frame was received.")
+    if encoder.num_frames < num_frames:
+        print(f"WARNING: The pose stream ended after {encoder.num_frames} frames, repeat the last frame.")
+        while encoder.num_frames < num_frames:
+            encoder.push(*last)
+    return encoder.finish(), height, width
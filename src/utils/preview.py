@@ -0,0 +1,135 @@
+# Copyright 2025 The RealisDance-DiT Team. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+"""
+Cheap latent -> RGB previews of running generations.
+
+A per-pixel linear projection of the 16 normalized Wan latent channels to RGB, fitted by least squares against
+VAE-encoded images, renders the predicted x0 at latent resolution (one frame per latent frame, 1/8 of the size)
+in well under a millisecond per step.
+"""
+import os
+
+import torch
+import torch.nn.functional as F
+
+from diffusers.utils import export_to_video
+
+
+class LatentPreviewDecoder(torch.nn.Module):
+    """
+    Linear latent -> RGB projection, i.e., a 1x1x1 conv from 16 latent channels to 3 color channels.
+    """
+
+    def __init__(self, latent_channels=16):
+        super().__init__()
+        self.proj = torch.nn.Conv3d(latent_channels, 3, kernel_size=1)
+
+    @torch.no_grad()
+    def forward(self, latents):
+        """
+        Normalized latents B C F h w -> uint8 frames B F h w 3.
+        """
+        self.proj.to(latents.device)
+        rgb = self.proj(latents.to(self.proj.weight.dtype))
+        rgb = ((rgb.clamp(-1, 1) + 1) * 127.5).round().to(torch.uint8)
+        return rgb.permute(0, 2, 3, 4, 1)
+
+    @staticmethod
+    def downsample(videos, scale_factor_temporal=4, scale_factor_spatial=8):
+        """
+        Videos B 3 F H W -> the latent grid B 3 F' h w: each latent frame is matched with the last frame it covers,
+        each latent pixel with the mean of its patch.
+        """
+        frame_index = list(range(0, videos.shape[2], scale_factor_temporal))
+        return F.avg_pool3d(videos[:, :, frame_index].float(), kernel_size=(1, scale_factor_spatial, scale_factor_spatial))
+
+    @classmethod
+    def fit(cls, latents, targets):
+        """
+        Least-squares fit from normalized latents (N C) to the RGB values in [-1, 1] they encode (N 3), see
+        `downsample` to align videos with their latents.
+        """
+        x = torch.cat([latents.float(), torch.ones_like(latents[:, :1]).float()], dim=1).cpu()  # bias
+        y = targets.float().cpu()
+        solution = torch.linalg.lstsq(x, y).solution  # (C + 1) x 3
+
+        decoder = cls(latents.shape[1])
+        decoder.proj.weight.data.copy_(solution[:-1].t().reshape(3, -1, 1, 1, 1))
+        decoder.proj.bias.data.copy_(solution[-1])
+        return decoder
+
+    def save(self, path):
+        torch.save(self.state_dict(), path)
+
+    @classmethod
+    def load(cls, path):
+        state_dict = torch.load(path, map_location="cpu")
+        decoder = cls(state_dict["proj.weight"].shape[1])
+        decoder.load_state_dict(state_dict)
+        return decoder
+
+
+@torch.no_grad()
+def fit_preview_decoder(pipe, images, max_resolution=512 * 512):
+    """
+    Fit a `LatentPreviewDecoder` to the VAE of `pipe` on a few images or videos (uint8 H W C / T H W C, or float
+    B C F H W in [-1, 1]), e.g., the reference image of a generation.
+    """
+    device = pipe._execution_device
+    latents_list, targets_list = [], []
+    for image in images:
+        video = pipe._normalize(pipe.prepare_input(image, device))
+        height, width = pipe.get_target_size(*video.shape[-2:], max_resolution)
+        video = pipe.process_shape(video, height, width, resize_type="resize_crop").to(pipe.vae.dtype)
+        latents = pipe.vae.encode(video).latent_dist.mode()
+        latents_mean, latents_std = pipe._get_latents_norm(latents.device, latents.dtype)
+        latents = (latents - latents_mean) * latents_std
+        targets = LatentPreviewDecoder.downsample(video, pipe.vae_scale_factor_temporal, pipe.vae_scale_factor_spatial)
+        latents_list.append(latents.permute(0, 2, 3, 4, 1).reshape(-1, latents.shape[1]))
+        targets_list.append(targets.permute(0, 2, 3, 4, 1).reshape(-1, 3))
+    return LatentPreviewDecoder.fit(torch.cat(latents_list), torch.cat(targets_list))
+
+
+class LatentPreviewer:
+    """
+    `callback_on_step_end` of `RealisDanceDiTPipeline` that renders the predicted x0 every `interval` steps:
+
+        previewer = LatentPreviewer(decoder, interval=5, save_dir="./output/preview")
+        pipe(..., callback_on_step_end=previewer, callback_on_step_end_tensor_inputs=previewer.tensor_inputs)
+
+    `on_preview(step, frames)` receives uint8 B F h w 3 frames, by default they are saved as mp4 to `save_dir`.
+    """
+
+    tensor_inputs = ["x0_pred"]
+
+    def __init__(self, decoder, interval=5, save_dir=None, on_preview=None, fps=4):
+        if save_dir is None and on_preview is None:
+            raise ValueError("Either `save_dir` or `on_preview` is required.")
+        self.decoder = decoder
+        self.interval = interval
+        self.save_dir = save_dir
+        self.on_preview = on_preview
+        self.fps = fps
+
+    def __call__(self, pipe, step, timestep, callback_kwargs):
+        if (step + 1) % self.interval == 0:
+            frames = self.decoder(callback_kwargs["x0_pred"]).cpu()
+            if self.on_preview is not None:
+                self.on_preview(step, frames)
+            else:
+                os.makedirs(self.save_dir, exist_ok=True)
+                for i, video in enumerate(frames.numpy()):
+                    output_path = os.path.join(self.save_dir, f"step{step + 1:03d}_{i}.mp4")
+                    export_to_video(list(video / 255.0), output_path, fps=self.fps)
+        return {}
@@ -0,0 +1,166 @@
+# Copyright 2025 The RealisDance-DiT Team. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+"""
+Inference snapshot of a prepared RealisDance-DiT pipeline.
+
+A snapshot stores the weights of every model component exactly as they are used at runtime (after dtype casts and
+any other post-load transform), so that loading is a zero-copy memory map instead of `from_pretrained` plus
+conversions. Layout of a snapshot file:
+
+    | magic (8 bytes) | header length (uint64, little endian) | json header | padding | page-aligned tensors |
+
+The json header records the class and config of every component, and dtype / shape / offset of every tensor.
+"""
+import importlib
+import json
+
+import numpy as np
+import torch
+
+SNAPSHOT_MAGIC = b"RDSNAP01"
+SNAPSHOT_ALIGN = 4096
+SNAPSHOT_MODULES = ("transformer", "text_encoder", "image_encoder", "vae")
+
+_DTYPES = {
+    "float32": torch.float32,
+    "float16": torch.float16,
+    "bfloat16": torch.bfloat16,
+    "float64": torch.float64,
+    "int64": torch.int64,
+    "int32": torch.int32,
+    "int8": torch.int8,
+    "uint8": torch.uint8,
+    "bool": torch.bool,
+}
+
+
+def _align(offset, alignment=SNAPSHOT_ALIGN):
+    return (offset + alignment - 1) // alignment * alignment
+
+
+def _class_path(obj):
+    cls = obj if isinstance(obj, type) else type(obj)
+    return f"{cls.__module__}:{cls.__qualname__}"
+
+
+def _import_class(path):
+    module, name = path.split(":")
+    return getattr(importlib.import_module(module), name)
+
+
+def _get_config(module):
+    if hasattr(module.config, "to_dict"):  # transformers
+        return module.config.to_dict()
+    return dict(module.config)  # diffusers
+
+
+def export_snapshot(pipe, path, tokenizer_path, dtype=None):
+    """
+    Serialize the model components of `pipe` into a single snapshot file.
+
+    Args:
+        pipe (`RealisDanceDiTPipeline`): a loaded pipeline, before offload hooks or FSDP are applied.
+        path (`str`): output path.
+        tokenizer_path (`str`): where the tokenizer is loaded from, tokenizers are tiny and stay in their own files.
+        dtype (`torch.dtype`, *optional*): cast floating point weights of transformer / text_encoder / image_encoder
+            to `dtype` before saving, e.g., `torch.float32` for the FSDP path which upcasts them anyway.
+    """
+    header = {
+        "pipeline": _class_path(pipe),
+        "tokenizer": {"class": _class_path(pipe.tokenizer), "path": tokenizer_path},
+        "scheduler": {"class": _class_path(pipe.scheduler), "config": dict(pipe.scheduler.config)},
+        "modules": {},
+    }
+    tensors = []
+    offset = 0
+    for name in SNAPSHOT_MODULES:
+        module = getattr(pipe, name)
+        entries = {}
+        for key, tensor in module.state_dict().items():
+            if dtype is not None and name != "vae" and tensor.is_floating_point():
+                tensor = tensor.to(dtype)
+            tensor = tensor.detach().to("cpu").contiguous()
+            entries[key] = {
+                "dtype": str(tensor.dtype).replace("torch.", ""),
+                "shape": list(tensor.shape),
+                "offset": offset,
+            }
+            tensors.append((offset, tensor))
+            offset = _align(offset + tensor.numel() * tensor.element_size())
+        header["modules"][name] = {
+            "class": _class_path(module),
+            "config_class": _class_path(module.config) if hasattr(module.config, "to_dict") else None,
+            "config": _get_config(module),
+            "tensors": entries,
+        }
+
+    header = json.dumps(header, default=str).encode("utf-8")
+    data_start = _align(len(SNAPSHOT_MAGIC) + 8 + len(header))
+    with open(path, "wb") as f:
+        f.write(SNAPSHOT_MAGIC)
+        f.write(np.uint64(len(header)).tobytes())
+        f.write(header)
+        for tensor_offset, tensor in tensors:
+            f.seek(data_start + tensor_offset)
+            f.write(tensor.reshape(-1).view(torch.uint8).numpy().tobytes())
+        f.truncate(data_start + offset)
+
+
+def _build_module(entry, state_dict):
+    from accelerate import init_empty_weights
+
+    cls = _import_class(entry["class"])
+    with init_empty_weights():
+        if entry["config_class"] is not None:  # transformers
+            config = _import_class(entry["config_class"]).from_dict(entry["config"])
+            module = cls(config)
+        else:  # diffusers
+            module = cls.from_config(entry["config"])
+    module.load_state_dict(state_dict, strict=True, assign=True)
+    if hasattr(module, "tie_weights"):
+        module.tie_weights()
+    return module.eval()
+
+
+def load_snapshot(path):
+    """
+    Load a pipeline from a snapshot written by `export_snapshot`. The weights are copy-on-write views of the
+    memory-mapped file, nothing is read until it is used and nothing is converted.
+    """
+    with open(path, "rb") as f:
+        if f.read(len(SNAPSHOT_MAGIC)) != SNAPSHOT_MAGIC:
+            raise ValueError(f"{path} is not an inference snapshot.")
+        header_len = int(np.frombuffer(f.read(8), dtype=np.uint64)[0])
+        header = json.loads(f.read(header_len).decode("utf-8"))
+    data_start = _align(len(SNAPSHOT_MAGIC) + 8 + header_len)
+    # copy-on-write, so torch gets writable tensors while the pages stay shared with the page cache
+    buffer = np.memmap(path, dtype=np.uint8, mode="c")
+
+    components = {}
+    for name, entry in header["modules"].items():
+        state_dict = {}
+        for key, info in entry["tensors"].items():
+            dtype = _DTYPES[info["dtype"]]
+            numel = int(np.prod(info["shape"]))
+            start = data_start + info["offset"]
+            nbytes = numel * torch.tensor([], dtype=dtype).element_size()
+            tensor = torch.from_numpy(buffer[start:start + nbytes]).view(dtype)
+            state_dict[key] = tensor.view(info["shape"])
+        components[name] = _build_module(entry, state_dict)
+
+    components["tokenizer"] = _import_class(header["tokenizer"]["class"]).from_pretrained(
+        header["tokenizer"]["path"], subfolder="tokenizer"
+    )
+    components["scheduler"] = _import_class(header["scheduler"]["class"]).from_config(header["scheduler"]["config"])
+    return _import_class(header["pipeline"])(**components)
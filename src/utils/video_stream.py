@@ -0,0 +1,89 @@
+# Copyright 2025 The RealisDance-DiT Team. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+"""
+Streaming video output: decode latent frames and write video frames while the generation is still running.
+"""
+import numpy as np
+import torch
+
+
+class StreamingVideoDecoder:
+    """
+    Decode normalized latents into video frames chunk by chunk.
+
+    The Wan VAE decoder is causal in time: the first latent frame decodes to one frame and every following latent
+    frame to 4 frames, with the temporal context carried in a feature cache. This class keeps its own feature cache
+    across `push` calls, so the frames are the same as `vae.decode` on all latents at once, decoding memory does not
+    grow with the clip length, and other VAE calls in between do not disturb it.
+    """
+
+    def __init__(self, pipe, output_type="np"):
+        if output_type not in ("np", "pt"):
+            raise ValueError(f"Unsupported output type for streaming decode: {output_type}")
+        self.pipe = pipe
+        self.vae = pipe.vae
+        self.output_type = output_type
+        self._feat_cache = [None] * self.vae._conv_num
+        self.num_latent_frames = 0
+
+    @torch.no_grad()
+    def push(self, latents):
+        """
+        Decode the next latent frames (normalized, B C F H W). Returns the new frames on the host, B F H W C in
+        [0, 1] for "np", B F C H W for "pt".
+        """
+        if hasattr(self.vae, "_hf_hook") and hasattr(self.vae._hf_hook, "pre_forward"):
+            # model cpu offload only hooks `vae.forward`, onload the vae by hand like `apply_forward_hook`
+            self.vae._hf_hook.pre_forward(self.vae)
+        latents_mean, latents_std = self.pipe._get_latents_norm(latents.device, self.vae.dtype)
+        x = self.vae.post_quant_conv(latents.to(self.vae.dtype) / latents_std + latents_mean)
+        chunks = []
+        for i in range(x.shape[2]):
+            out = self.vae.decoder(x[:, :, i:i + 1], feat_cache=self._feat_cache, feat_idx=[0])
+            out = self.pipe.video_processor.postprocess_video(out.clamp(-1.0, 1.0), output_type=self.output_type)
+            chunks.append(out if self.output_type == "np" else out.cpu())
+        self.num_latent_frames += x.shape[2]
+        return np.concatenate(chunks, axis=1) if self.output_type == "np" else torch.cat(chunks, dim=1)
+
+    def finish(self):
+        self._feat_cache = []
+
+
+class StreamingVideoWriter:
+    """
+    Append frames to a video file as they are generated, with the same encoder settings as `export_to_video`.
+    """
+
+    def __init__(self, path, fps=16, quality=5.0):
+        import imageio
+
+        self._writer = imageio.get_writer(path, fps=fps, quality=quality)
+        self.num_frames = 0
+
+    def write(self, frames):
+        """
+        Append float frames in [0, 1], F H W C.
+        """
+        for frame in frames:
+            self._writer.append_data((frame * 255).round().astype(np.uint8))
+        self.num_frames += len(frames)
+
+    def close(self):
+        self._writer.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
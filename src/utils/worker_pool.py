@@ -0,0 +1,147 @@
+# Copyright 2025 The RealisDance-DiT Team. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+import glob
+import multiprocessing
+import os
+import queue
+import traceback
+
+import torch
+
+
+def _parse_cpulist(text):
+    # "0-3,8-11" -> [0, 1, 2, 3, 8, 9, 10, 11]
+    cpus = []
+    for part in text.strip().split(","):
+        if not part:
+            continue
+        if "-" in part:
+            start, end = part.split("-")
+            cpus.extend(range(int(start), int(end) + 1))
+        else:
+            cpus.append(int(part))
+    return cpus
+
+
+def get_numa_nodes():
+    """
+    CPUs of every NUMA node this process may run on, as {node: [cpu, ...]}.
+    """
+    allowed = os.sched_getaffinity(0)
+    nodes = {}
+    for path in sorted(glob.glob("/sys/devices/system/node/node[0-9]*/cpulist")):
+        with open(path, "r", encoding="utf-8") as f:
+            cpus = [cpu for cpu in _parse_cpulist(f.read()) if cpu in allowed]
+        if cpus:
+            nodes[int(os.path.basename(os.path.dirname(path))[len("node"):])] = cpus
+    return nodes or {0: sorted(allowed)}
+
+
+def get_core_sets(num_workers):
+    """
+    Split the allowed CPUs into `num_workers` disjoint sets. Workers are spread round robin over the NUMA nodes and
+    never span two nodes, so their activations stay in node-local memory.
+    """
+    nodes = list(get_numa_nodes().values())
+    workers_per_node = [len(range(i, num_workers, len(nodes))) for i in range(len(nodes))]
+    core_sets = []
+    for cpus, num in zip(nodes, workers_per_node):
+        if num == 0:
+            continue
+        if num > len(cpus):
+            raise ValueError(f"Cannot pin {num} workers to a NUMA node with {len(cpus)} cpus.")
+        bounds = [len(cpus) * i // num for i in range(num + 1)]
+        core_sets.extend(cpus[start:end] for start, end in zip(bounds[:-1], bounds[1:]))
+    return core_sets
+
+
+def share_pipeline_memory(pipe):
+    """
+    Move the weights of every module of the pipeline to shared memory, so that forked workers read one copy.
+    """
+    for component in pipe.components.values():
+        if isinstance(component, torch.nn.Module):
+            component.share_memory()
+    return pipe
+
+
+def _worker_loop(rank, cores, run_job, jobs, results):
+    os.sched_setaffinity(0, cores)
+    torch.set_num_threads(len(cores))
+    while True:
+        item = jobs.get()
+        if item is None:
+            return
+        index, job = item
+        try:
+            results.put((index, run_job(job), None))
+        except Exception:
+            results.put((index, None, f"Worker {rank} failed:\n{traceback.format_exc()}"))
+
+
+class CPUWorkerPool:
+    r"""
+    Run jobs on a pipeline loaded once, in `num_workers` forked CPU processes.
+
+    The pipeline weights are moved to shared memory before forking (or already live in a shared mmap when loaded
+    with `load_snapshot`), so memory does not grow with the number of workers. Each worker is pinned to its own core
+    set from `get_core_sets` and sizes its intra-op thread pool to it.
+
+    Args:
+        pipe (`RealisDanceDiTPipeline`): the loaded pipeline, on CPU.
+        run_job (`Callable[[Any], Any]`): runs one job in a worker and returns a picklable result, e.g., the output
+            path. Called after fork, so it may close over `pipe`.
+        num_workers (`int`): number of worker processes.
+        share_memory (`bool`): move weights to shared memory. Not needed for snapshot-loaded pipelines, whose
+            copy-on-write mmap is shared across fork already.
+    """
+
+    def __init__(self, pipe, run_job, num_workers, share_memory=True):
+        if share_memory:
+            share_pipeline_memory(pipe)
+        self.run_job = run_job
+        self.core_sets = get_core_sets(num_workers)
+
+    def map(self, jobs):
+        """
+        Run all jobs and yield (job, result, error) in completion order.
+        """
+        jobs = list(jobs)
+        ctx = multiprocessing.get_context("fork")
+        job_queue, result_queue = ctx.Queue(), ctx.Queue()
+        for item in enumerate(jobs):
+            job_queue.put(item)
+        for _ in self.core_sets:
+            job_queue.put(None)
+
+        workers = [
+            ctx.Process(target=_worker_loop, args=(rank, cores, self.run_job, job_queue, result_queue), daemon=True)
+            for rank, cores in enumerate(self.core_sets)
+        ]
+        for worker in workers:
+            worker.start()
+        try:
+            for _ in range(len(jobs)):
+                while True:
+                    try:
+                        index, result, error = result_queue.get(timeout=10)
+                        break
+                    except queue.Empty:
+                        # e.g., all workers killed by the OOM killer
+                        if not any(worker.is_alive() for worker in workers):
+                            raise RuntimeError("All workers exited before finishing the jobs.")
+                yield jobs[index], result, error
+        finally:
+            for worker in workers:
+                worker.join()